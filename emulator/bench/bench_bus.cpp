@@ -0,0 +1,104 @@
+#include "bench_harness.hpp"
+#include <core/bus.hpp>
+#include <devices/memory.hpp>
+#include <memory>
+#include <vector>
+
+#define SX64_BENCH_BUS_DEVICE_SIZE (64 * 1024)
+#define SX64_BENCH_MEMORY_SIZE (1024 * 1024)
+#define SX64_BENCH_ADDRESSES 4096 // Power of two, cycled through by every access benchmark
+
+// Addresses spread over [base, base + size), the same sequence every run
+static std::vector<uint64_t> makeAddresses(uint64_t base, uint64_t size, uint64_t alignment)
+{
+    std::vector<uint64_t> addresses(SX64_BENCH_ADDRESSES);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t &address : addresses)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        address = base + ((state >> 16) % (size / alignment)) * alignment;
+    }
+    return addresses;
+}
+
+static void benchBusDevices(BenchHarness &harness, int deviceCount)
+{
+    Bus bus;
+    for (int i = 0; i < deviceCount; ++i)
+    {
+        bus.attachDevice(std::make_shared<MemoryDevice>("bench " + std::to_string(i), SX64_BENCH_BUS_DEVICE_SIZE, false,
+                                                        static_cast<uint64_t>(i) * SX64_BENCH_BUS_DEVICE_SIZE));
+    }
+
+    std::vector<uint64_t> addresses = makeAddresses(0, static_cast<uint64_t>(deviceCount) * SX64_BENCH_BUS_DEVICE_SIZE, 1);
+    std::string suffix = "/" + std::to_string(deviceCount) + "_devices";
+
+    harness.run("bus.read" + suffix, [&](uint64_t iterations)
+    {
+        uint8_t sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            sum += bus.read(addresses[i & (SX64_BENCH_ADDRESSES - 1)]);
+        }
+        doNotOptimize(sum);
+    });
+
+    harness.run("bus.write" + suffix, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            bus.write(addresses[i & (SX64_BENCH_ADDRESSES - 1)], static_cast<uint8_t>(i));
+        }
+    });
+}
+
+static void benchMemory(BenchHarness &harness)
+{
+    MemoryDevice memory("bench", SX64_BENCH_MEMORY_SIZE, false);
+    std::vector<uint64_t> addresses = makeAddresses(0, SX64_BENCH_MEMORY_SIZE, 8);
+
+    harness.run("memory.read8", [&](uint64_t iterations)
+    {
+        uint8_t sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            sum += memory.read(addresses[i & (SX64_BENCH_ADDRESSES - 1)]);
+        }
+        doNotOptimize(sum);
+    }, 0, 1);
+
+    harness.run("memory.read64", [&](uint64_t iterations)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            sum += memory.read64(addresses[i & (SX64_BENCH_ADDRESSES - 1)]);
+        }
+        doNotOptimize(sum);
+    }, 0, 8);
+
+    harness.run("memory.write8", [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            memory.write(addresses[i & (SX64_BENCH_ADDRESSES - 1)], static_cast<uint8_t>(i));
+        }
+    }, 0, 1);
+
+    harness.run("memory.write64", [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            memory.write64(addresses[i & (SX64_BENCH_ADDRESSES - 1)], i);
+        }
+    }, 0, 8);
+}
+
+void benchBus(BenchHarness &harness)
+{
+    for (int deviceCount : {1, 4, 32})
+    {
+        benchBusDevices(harness, deviceCount);
+    }
+    benchMemory(harness);
+}
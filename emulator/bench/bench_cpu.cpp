@@ -0,0 +1,186 @@
+#include "bench_harness.hpp"
+#include <core/machine.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#define SX64_BENCH_RAM_SIZE (1024 * 1024)
+#define SX64_BENCH_PROGRAM SX64_SYS_BOOTSTRAP_SIZE // Start of RAM
+#define SX64_BENCH_DATA (SX64_BENCH_PROGRAM + SX64_BENCH_RAM_SIZE / 2)
+#define SX64_BENCH_BLOCK_INSTRUCTIONS 64 // Straight-line instructions before the loop jumps back
+#define SX64_BENCH_LOOP_BODY 30          // ADDs per iteration of the engine loop
+
+using Program = std::vector<uint8_t>;
+
+static void emit64(Program &program, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        program.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+static void emitJump(Program &program, uint8_t opcode, uint64_t target)
+{
+    program.push_back(opcode);
+    emit64(program, target);
+}
+
+// Appends one instance of an opcode class at the given guest address, returns its instruction count
+using Emitter = std::function<int(Program &program, uint64_t address)>;
+
+struct OpcodeClass
+{
+    const char *name;
+    Emitter emit;
+};
+
+static std::unique_ptr<sx64::Machine> createMachine(sx64::Engine engine, uint64_t cycleBudget, const Program &program)
+{
+    sx64::MachineConfig config;
+    config.ramSize = SX64_BENCH_RAM_SIZE;
+    config.engine = engine;
+    config.clockFrequency = 0;
+    config.cycleBudget = cycleBudget;
+
+    std::unique_ptr<sx64::Machine> machine = sx64::Machine::create(config, std::make_unique<BufferSerialBackend>());
+    machine->getBus()->writeBlock(SX64_BENCH_PROGRAM, program.data(), program.size());
+
+    sx64::CPU &cpu = machine->getCpu();
+    cpu.start(SX64_BENCH_PROGRAM, SX64_BENCH_PROGRAM + SX64_BENCH_RAM_SIZE);
+    cpu.setRegister(1, 1);
+    cpu.setRegister(2, 5);
+    cpu.setRegister(3, 1); // Divisor
+    return machine;
+}
+
+static void benchStep(BenchHarness &harness, const OpcodeClass &opcodeClass)
+{
+    std::string name = std::string("cpu.step/") + opcodeClass.name;
+    if (!harness.wants(name))
+    {
+        return;
+    }
+
+    // A block of the class with a jump back to its start, so the jump is a small share of the steps
+    Program program;
+    int instructions = 0;
+    while (instructions < SX64_BENCH_BLOCK_INSTRUCTIONS)
+    {
+        instructions += opcodeClass.emit(program, SX64_BENCH_PROGRAM + program.size());
+    }
+    emitJump(program, sx64::InstructionType::JMP, SX64_BENCH_PROGRAM);
+
+    std::unique_ptr<sx64::Machine> machine = createMachine(sx64::Engine::Switch, 0, program);
+    sx64::CPU &cpu = machine->getCpu();
+
+    harness.run(name, [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            cpu.step();
+        }
+    }, 1);
+}
+
+static void benchEngine(BenchHarness &harness, const char *name, sx64::Engine engine)
+{
+    // loop: ADD R2, R3 (repeated), JMP loop. The cycle budget decides how many iterations run.
+    Program program;
+    uint64_t cyclesPerIteration = 0;
+    for (int i = 0; i < SX64_BENCH_LOOP_BODY; ++i)
+    {
+        program.insert(program.end(), {sx64::InstructionType::ADD, 2, 3});
+        cyclesPerIteration += sx64::instructionCycles(sx64::InstructionType::ADD);
+    }
+    emitJump(program, sx64::InstructionType::JMP, SX64_BENCH_PROGRAM);
+    cyclesPerIteration += sx64::instructionCycles(sx64::InstructionType::JMP);
+
+    // An operation is one loop iteration, the machine is built fresh for each pass so nothing is cached
+    harness.run(std::string("cpu.run/") + name, [&](uint64_t iterations)
+    {
+        std::unique_ptr<sx64::Machine> machine = createMachine(engine, iterations * cyclesPerIteration, program);
+        machine->run();
+        doNotOptimize(machine->getCpu().getRegister(2));
+    }, SX64_BENCH_LOOP_BODY + 1);
+}
+
+void benchCpu(BenchHarness &harness)
+{
+    using namespace sx64;
+
+    const OpcodeClass classes[] = {
+        {"nop", [](Program &program, uint64_t)
+         {
+             program.push_back(InstructionType::NOP);
+             return 1;
+         }},
+        {"ldi", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::LDI, 4});
+             emit64(program, 0x0123456789ABCDEFULL);
+             return 1;
+         }},
+        {"add", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::ADD, 4, 1});
+             return 1;
+         }},
+        {"mul", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::MUL, 4, 2});
+             return 1;
+         }},
+        {"div", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::DIV, 4, 3});
+             return 1;
+         }},
+        {"read", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::READ, 4});
+             emit64(program, SX64_BENCH_DATA);
+             return 1;
+         }},
+        {"write", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::WRITE, 2});
+             emit64(program, SX64_BENCH_DATA);
+             return 1;
+         }},
+        {"ld64", [](Program &program, uint64_t)
+         {
+             // Base R5 is zero, the displacement is the whole address
+             program.insert(program.end(), {InstructionType::LD64, 4, 5});
+             emit64(program, SX64_BENCH_DATA);
+             return 1;
+         }},
+        {"st64", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::ST64, 2, 5});
+             emit64(program, SX64_BENCH_DATA);
+             return 1;
+         }},
+        {"push_pop", [](Program &program, uint64_t)
+         {
+             program.insert(program.end(), {InstructionType::PUSH, 2, InstructionType::POP, 4});
+             return 2;
+         }},
+        {"cmp_branch", [](Program &program, uint64_t address)
+         {
+             // R1 != R2, so JNE is taken, to the very next instruction
+             program.insert(program.end(), {InstructionType::CMP, 1, 2});
+             emitJump(program, InstructionType::JNE, address + 3 + instructionLength(InstructionType::JNE));
+             return 2;
+         }},
+    };
+
+    for (const OpcodeClass &opcodeClass : classes)
+    {
+        benchStep(harness, opcodeClass);
+    }
+
+    benchEngine(harness, "switch", Engine::Switch);
+    benchEngine(harness, "threaded", Engine::Threaded);
+    benchEngine(harness, "jit", Engine::Jit);
+}
@@ -0,0 +1,115 @@
+#include "bench_harness.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+BenchHarness::BenchHarness(uint64_t minTimeMs, const std::string &filter)
+    : minTimeNs(minTimeMs * 1000000), filter(filter)
+{
+}
+
+bool BenchHarness::wants(const std::string &name) const
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+static uint64_t timeBody(const BenchHarness::Body &body, uint64_t iterations)
+{
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    body(iterations);
+    return duration_cast<nanoseconds>(steady_clock::now() - start).count();
+}
+
+void BenchHarness::run(const std::string &name, const Body &body, double instructionsPerOp, double bytesPerOp)
+{
+    if (!wants(name))
+    {
+        return;
+    }
+
+    // Grow the iteration count until one pass fills the minimum time, aiming a little past it
+    uint64_t iterations = 1;
+    uint64_t elapsed = timeBody(body, iterations);
+    while (elapsed < minTimeNs)
+    {
+        double scale = elapsed ? 1.4 * minTimeNs / elapsed : 100.0;
+        iterations = std::max(iterations + 1, static_cast<uint64_t>(iterations * std::min(scale, 100.0)));
+        elapsed = timeBody(body, iterations);
+    }
+
+    for (int i = 1; i < SX64_BENCH_REPETITIONS; ++i)
+    {
+        elapsed = std::min(elapsed, timeBody(body, iterations));
+    }
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = static_cast<double>(elapsed) / iterations;
+    result.mips = instructionsPerOp * iterations * 1000.0 / elapsed;
+    result.bytesPerSecond = bytesPerOp * iterations * 1e9 / elapsed;
+    report(result);
+}
+
+void BenchHarness::report(const BenchResult &result)
+{
+    if (!wants(result.name))
+    {
+        return;
+    }
+
+    std::printf("%-40s %14.2f ns/op", result.name.c_str(), result.nsPerOp);
+    if (result.mips > 0)
+    {
+        std::printf(" %10.2f MIPS", result.mips);
+    }
+    if (result.bytesPerSecond > 0)
+    {
+        std::printf(" %10.2f MB/s", result.bytesPerSecond / 1e6);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+
+    results.push_back(result);
+}
+
+bool BenchHarness::writeJson(const std::string &path) const
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+    {
+        spdlog::error("Could not open \"{}\" for the benchmark results", path);
+        return false;
+    }
+
+    // Names are ours and never need escaping
+    std::fprintf(file, "{\n  \"context\": {\n");
+    std::fprintf(file, "    \"compiler\": \"%s\",\n", __VERSION__);
+    std::fprintf(file, "    \"host_threads\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(file, "    \"min_time_ms\": %llu,\n", static_cast<unsigned long long>(minTimeNs / 1000000));
+    std::fprintf(file, "    \"repetitions\": %d\n  },\n", SX64_BENCH_REPETITIONS);
+    std::fprintf(file, "  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &result = results[i];
+        std::fprintf(file, "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"mips\": %.3f, \"bytes_per_second\": %.0f}",
+                     i ? "," : "", result.name.c_str(), static_cast<unsigned long long>(result.iterations),
+                     result.nsPerOp, result.mips, result.bytesPerSecond);
+    }
+    std::fprintf(file, "\n  ]\n}\n");
+
+    bool ok = std::fclose(file) == 0;
+    if (!ok)
+    {
+        spdlog::error("Could not write the benchmark results to \"{}\"", path);
+    }
+    return ok;
+}
+
+const std::vector<BenchResult> &BenchHarness::getResults() const
+{
+    return results;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define SX64_BENCH_MIN_TIME_MS 200 // Each measurement runs at least this long
+#define SX64_BENCH_REPETITIONS 3   // The fastest repetition is reported
+#define SX64_BENCH_DEFAULT_JSON "bench.json"
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations = 0;
+    double nsPerOp = 0;
+    double mips = 0;          // Emulated instructions per host microsecond, 0 when not measuring the CPU
+    double bytesPerSecond = 0; // Host throughput, 0 when not measuring a byte stream
+};
+
+// Keeps the compiler from discarding a value the benchmark computed
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class BenchHarness
+{
+public:
+    // Body performs the given number of operations. The emulated instructions or bytes each
+    // operation stands for give the MIPS and throughput columns.
+    using Body = std::function<void(uint64_t iterations)>;
+
+    BenchHarness(uint64_t minTimeMs, const std::string &filter);
+
+    bool wants(const std::string &name) const;
+    void run(const std::string &name, const Body &body, double instructionsPerOp = 0, double bytesPerOp = 0);
+    // For measurements that cannot be repeated on demand, such as a whole machine run
+    void report(const BenchResult &result);
+
+    bool writeJson(const std::string &path) const;
+    const std::vector<BenchResult> &getResults() const;
+
+private:
+    uint64_t minTimeNs;
+    std::string filter;
+    std::vector<BenchResult> results;
+};
+
+// Suites, one per source file
+void benchBus(BenchHarness &harness);
+void benchCpu(BenchHarness &harness);
+void benchIo(BenchHarness &harness);
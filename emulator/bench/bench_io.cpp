@@ -0,0 +1,124 @@
+#include "bench_harness.hpp"
+#include <devices/memory.hpp>
+#include <devices/serial.hpp>
+#include <devices/serial_stream.hpp>
+#include <spdlog/spdlog.h>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#define SX64_BENCH_SERIAL_CHUNK (1024 * 1024) // Buffered output is dropped after this many bytes
+
+static void benchSerial(BenchHarness &harness)
+{
+    auto buffer = std::make_unique<BufferSerialBackend>();
+    BufferSerialBackend &output = *buffer;
+    SerialDevice bufferDevice("bench buffer", std::move(buffer), 0);
+
+    harness.run("serial.write/buffer", [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            bufferDevice.write(0, static_cast<uint8_t>('A' + i % 26));
+            if ((i & (SX64_BENCH_SERIAL_CHUNK - 1)) == 0)
+            {
+                output.restoreHistory({});
+            }
+        }
+    }, 0, 1);
+
+    // The stream backend with its drain thread, as in a headless run with --serial file:...
+    std::unique_ptr<StreamSerialBackend> stream = StreamSerialBackend::openFile("/dev/null");
+    if (!stream)
+    {
+        spdlog::warn("Skipping serial.write/stream, /dev/null could not be opened");
+        return;
+    }
+    SerialDevice streamDevice("bench stream", std::move(stream), 0);
+
+    harness.run("serial.write/stream", [&](uint64_t iterations)
+    {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            streamDevice.write(0, static_cast<uint8_t>('A' + i % 26));
+        }
+    }, 0, 1);
+}
+
+static std::string writeImage(uint64_t size)
+{
+    const char *tmp = std::getenv("TMPDIR");
+    std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/sx64-bench-XXXXXX";
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+    {
+        return {};
+    }
+
+    std::vector<uint8_t> chunk(1024 * 1024);
+    for (size_t i = 0; i < chunk.size(); ++i)
+    {
+        chunk[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    bool ok = true;
+    for (uint64_t written = 0; ok && written < size;)
+    {
+        ssize_t result = ::write(fd, chunk.data(), std::min<uint64_t>(chunk.size(), size - written));
+        ok = result > 0;
+        written += ok ? result : 0;
+    }
+    close(fd);
+
+    if (!ok)
+    {
+        unlink(path.c_str());
+        return {};
+    }
+    return path;
+}
+
+static void benchImageLoad(BenchHarness &harness)
+{
+    for (uint64_t size : {64ULL * 1024, 1024ULL * 1024, 16ULL * 1024 * 1024, 64ULL * 1024 * 1024})
+    {
+        std::string name = "image.load/" + std::to_string(size / 1024) + "KiB";
+        if (!harness.wants(name))
+        {
+            continue;
+        }
+
+        std::string path = writeImage(size);
+        if (path.empty())
+        {
+            spdlog::warn("Skipping {}, the image could not be written", name);
+            continue;
+        }
+
+        // Loading maps the file, touching a byte per page makes the guest see all of it
+        MemoryDevice memory("bench image", size, false);
+        harness.run(name, [&](uint64_t iterations)
+        {
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                memory.loadImage(path);
+                uint8_t sum = 0;
+                for (uint64_t address = 0; address < size; address += 4096)
+                {
+                    sum += memory.read(address);
+                }
+                doNotOptimize(sum);
+            }
+        }, 0, static_cast<double>(size));
+
+        unlink(path.c_str());
+    }
+}
+
+void benchIo(BenchHarness &harness)
+{
+    benchSerial(harness);
+    benchImageLoad(harness);
+}
@@ -0,0 +1,66 @@
+#include "bench_harness.hpp"
+#include <spdlog/spdlog.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+void print_help()
+{
+    std::cout << "Usage: sx64-bench [OPTIONS...]\n\n"
+              << "Options:\n"
+              << "  -h, --help               Show this help message\n"
+              << "  -o, --output <file>      Write the results as JSON to file (default: " SX64_BENCH_DEFAULT_JSON ")\n"
+              << "  -f, --filter <text>      Only run benchmarks whose name contains text\n"
+              << "  --min-time=<ms>          Minimum time each measurement runs (default: " << SX64_BENCH_MIN_TIME_MS << ")\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::string output = SX64_BENCH_DEFAULT_JSON;
+    std::string filter;
+    uint64_t minTimeMs = SX64_BENCH_MIN_TIME_MS;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            print_help();
+            return 0;
+        }
+        else if ((arg == "-o" || arg == "--output") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if ((arg == "-f" || arg == "--filter") && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (arg.rfind("--min-time=", 0) == 0)
+        {
+            minTimeMs = std::strtoull(arg.c_str() + 11, nullptr, 10);
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << "\n";
+            print_help();
+            return 1;
+        }
+    }
+
+    // The devices log every access at debug and trace level, which would be measured along with them
+    spdlog::set_level(spdlog::level::warn);
+
+    BenchHarness harness(minTimeMs, filter);
+    benchBus(harness);
+    benchCpu(harness);
+    benchIo(harness);
+
+    if (harness.getResults().empty())
+    {
+        spdlog::error("No benchmark matches \"{}\"", filter);
+        return 1;
+    }
+
+    return harness.writeJson(output) ? 0 : 1;
+}
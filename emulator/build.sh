@@ -1,10 +1,14 @@
 #!/bin/bash
 
 SRC_DIR="src"
+BENCH_DIR="bench"
+TEST_DIR="tests"
 OBJ_DIR="build"
 EXE="sx64-generic-emu"
+BENCH_EXE="sx64-bench"
+TEST_EXE="sx64-tests"
 
-CC="clang++"
+CC="${CC:-clang++}"
 
 CFLAGS="-Wall -Wextra -O3 -I$SRC_DIR"
 LDFLAGS=""
@@ -13,6 +17,8 @@ LIBS=""
 
 NUM_JOBS=$(nproc)
 FORCE_REBUILD=0
+HEADLESS=0
+SX64_MIN_LOG_LEVEL="${SX64_MIN_LOG_LEVEL:-trace}"
 
 COLOR_RESET="\033[0m"
 COLOR_WARN="\033[1;33m"
@@ -30,6 +36,9 @@ print_help() {
     echo -e "  -c, --clean         ${COLOR_INFO}Clean the build directory.${COLOR_RESET}"
     echo -e "  -j, --jobs <N>      ${COLOR_INFO}Set the number of parallel jobs (default: number of CPU cores).${COLOR_RESET}"
     echo -e "  -o, --output <FILE> ${COLOR_INFO}Set the name of the output executable (default: sx64-generic-emu).${COLOR_RESET}"
+    echo -e "  -l, --min-log-level <LEVEL> ${COLOR_INFO}Compile out hot-path logging below LEVEL: trace, debug, info, warn, error, critical, off (default: trace).${COLOR_RESET}"
+    echo -e "  -r, --release       ${COLOR_INFO}Release build, same as --min-log-level info.${COLOR_RESET}"
+    echo -e "  -H, --headless      ${COLOR_INFO}Build without SDL, serial output goes to stdio, a file or a pty.${COLOR_RESET}"
     echo -e "  -h, --help          ${COLOR_INFO}Display this help message and exit.${COLOR_RESET}"
 }
 
@@ -127,6 +136,23 @@ while [[ $# -gt 0 ]]; do
                 exit 1
             fi
             ;;
+        -l|--min-log-level)
+            if [[ -n "$2" ]]; then
+                SX64_MIN_LOG_LEVEL="$2"
+                shift 2
+            else
+                echo -e "${COLOR_ERROR}Error: --min-log-level requires a level.${COLOR_RESET}"
+                exit 1
+            fi
+            ;;
+        -r|--release)
+            SX64_MIN_LOG_LEVEL="info"
+            shift
+            ;;
+        -H|--headless)
+            HEADLESS=1
+            shift
+            ;;
         -h|--help)
             print_help
             exit 0
@@ -139,6 +165,16 @@ while [[ $# -gt 0 ]]; do
     esac
 done
 
+case "$SX64_MIN_LOG_LEVEL" in
+    trace|debug|info|warn|error|critical|off)
+        CFLAGS+=" -DSPDLOG_ACTIVE_LEVEL=SPDLOG_LEVEL_${SX64_MIN_LOG_LEVEL^^}"
+        ;;
+    *)
+        echo -e "${COLOR_ERROR}Error: unknown log level \"$SX64_MIN_LOG_LEVEL\".${COLOR_RESET}"
+        exit 1
+        ;;
+esac
+
 if command -v pkg-config >/dev/null 2>&1; then
     if ! pkg-config --exists spdlog; then
         echo -e "${COLOR_WARN}spdlog not found. Installing...${COLOR_RESET}"
@@ -152,20 +188,30 @@ else
     exit 1
 fi
 
-# Check and install SDL2
-if ! pkg-config --exists sdl2; then
-    echo -e "${COLOR_WARN}SDL2 not found. Installing...${COLOR_RESET}"
-    install_sdl2
+if [[ $HEADLESS -eq 1 ]]; then
+    CFLAGS+=" -DSX64_HEADLESS"
+else
+    # Check and install SDL2
+    if ! pkg-config --exists sdl2; then
+        echo -e "${COLOR_WARN}SDL2 not found. Installing...${COLOR_RESET}"
+        install_sdl2
+    fi
+    echo -e "${COLOR_INFO}SDL2 installed${COLOR_RESET}"
+    INCLUDES+=" $(pkg-config --cflags sdl2 SDL2_ttf)"
+    LIBS+=" $(pkg-config --libs sdl2 SDL2_ttf)"
 fi
-echo -e "${COLOR_INFO}SDL2 installed${COLOR_RESET}"
-INCLUDES+=" $(pkg-config --cflags sdl2 SDL2_ttf)"
-LIBS+=" $(pkg-config --libs sdl2 SDL2_ttf)"
 
-mkdir -p "$OBJ_DIR"
+mkdir -p "$OBJ_DIR" "$OBJ_DIR/$BENCH_DIR" "$OBJ_DIR/$TEST_DIR"
+
+# Objects built with other flags (log level, headless) are stale even when newer than their sources
+if [[ "$(cat "$OBJ_DIR/.cflags" 2>/dev/null)" != "$CFLAGS" ]]; then
+    FORCE_REBUILD=1
+    echo "$CFLAGS" > "$OBJ_DIR/.cflags"
+fi
 
 compile_source() {
     src_file="$1"
-    obj_file="${OBJ_DIR}/$(basename "${src_file%.*}.o")"
+    obj_file="$2/$(basename "${src_file%.*}.o")"
 
     if [[ $FORCE_REBUILD -eq 0 && -f "$obj_file" && "$obj_file" -nt "$src_file" ]]; then
         echo -e "${COLOR_SKIPPING}Skipping${COLOR_RESET} $src_file -> $obj_file (up to date)"
@@ -181,8 +227,15 @@ compile_source() {
 
 PIDS=()
 
-for src_file in $(find "$SRC_DIR" -type f -name "*.cpp"); do
-    compile_source "$src_file" &
+# Benchmark and test objects go in their own directories, they link against everything but main.o
+for src_file in $(find "$SRC_DIR" "$BENCH_DIR" "$TEST_DIR" -type f -name "*.cpp"); do
+    if [[ "$src_file" == "$BENCH_DIR"/* ]]; then
+        compile_source "$src_file" "$OBJ_DIR/$BENCH_DIR" &
+    elif [[ "$src_file" == "$TEST_DIR"/* ]]; then
+        compile_source "$src_file" "$OBJ_DIR/$TEST_DIR" &
+    else
+        compile_source "$src_file" "$OBJ_DIR" &
+    fi
     PIDS+=($!)
     if (( ${#PIDS[@]} >= NUM_JOBS )); then
         wait -n
@@ -193,10 +246,20 @@ done
 wait "${PIDS[@]}"
 
 echo -e "${COLOR_LINKING}Linking${COLOR_RESET} object files into $EXE"
-OBJ_FILES=$(find "$OBJ_DIR" -type f -name "*.o")
+OBJ_FILES=$(find "$OBJ_DIR" -maxdepth 1 -type f -name "*.o")
 if [ -n "$OBJ_FILES" ]; then
     $CC $OBJ_FILES $LIBS -o "$EXE" 2>&1 | sed "s/^/  /"
     echo -e "${COLOR_INFO}Build complete!${COLOR_RESET} Executable: $EXE"
 else
     echo -e "${COLOR_ERROR}No object files found for linking.${COLOR_RESET}"
 fi
+
+echo -e "${COLOR_LINKING}Linking${COLOR_RESET} object files into $BENCH_EXE"
+BENCH_OBJ_FILES="$(find "$OBJ_DIR/$BENCH_DIR" -type f -name "*.o") $(find "$OBJ_DIR" -maxdepth 1 -type f -name "*.o" ! -name "main.o")"
+$CC $BENCH_OBJ_FILES $LIBS -o "$BENCH_EXE" 2>&1 | sed "s/^/  /"
+echo -e "${COLOR_INFO}Build complete!${COLOR_RESET} Executable: $BENCH_EXE"
+
+echo -e "${COLOR_LINKING}Linking${COLOR_RESET} object files into $TEST_EXE"
+TEST_OBJ_FILES="$(find "$OBJ_DIR/$TEST_DIR" -type f -name "*.o") $(find "$OBJ_DIR" -maxdepth 1 -type f -name "*.o" ! -name "main.o")"
+$CC $TEST_OBJ_FILES $LIBS -o "$TEST_EXE" 2>&1 | sed "s/^/  /"
+echo -e "${COLOR_INFO}Build complete!${COLOR_RESET} Executable: $TEST_EXE"
@@ -0,0 +1,147 @@
+#include <batch.hpp>
+#include <spdlog/spdlog.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct BatchResult
+{
+    std::string name;
+    bool passed = false;
+    std::string reason; // Why the run failed
+    uint64_t cycles = 0;
+};
+
+static bool readFile(const fs::path &path, std::string &contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+static BatchResult runOne(const fs::path &image, sx64::MachineConfig config)
+{
+    BatchResult result;
+    result.name = image.stem().string();
+    config.ramImage = image.string();
+
+    auto serial = std::make_unique<BufferSerialBackend>();
+    const BufferSerialBackend &output = *serial;
+    std::unique_ptr<sx64::Machine> machine = sx64::Machine::create(config, std::move(serial));
+    if (!machine)
+    {
+        result.reason = "the machine could not be set up";
+        return result;
+    }
+
+    machine->run();
+    result.cycles = machine->getCpu().getCycles();
+
+    if (machine->isBudgetExhausted())
+    {
+        result.reason = fmt::format("still running after {} cycles", config.cycleBudget);
+        return result;
+    }
+
+    fs::path goldenPath = fs::path(image).replace_extension(SX64_BATCH_GOLDEN_EXTENSION);
+    std::string golden;
+    if (!readFile(goldenPath, golden))
+    {
+        result.reason = fmt::format("no golden output in {}", goldenPath.string());
+        return result;
+    }
+
+    const std::string &actual = output.getOutput();
+    if (actual != golden)
+    {
+        size_t offset = std::mismatch(actual.begin(), actual.end(), golden.begin(), golden.end()).first - actual.begin();
+        result.reason = fmt::format("output differs from golden at byte {} ({} bytes written, {} expected)", offset, actual.size(), golden.size());
+        return result;
+    }
+
+    result.passed = true;
+    return result;
+}
+
+int runBatch(const std::string &directory, unsigned jobs, const sx64::MachineConfig &config)
+{
+    using namespace std::chrono;
+
+    std::vector<fs::path> images;
+    std::error_code error;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+    {
+        if (it->is_regular_file() && it->path().extension() == SX64_BATCH_IMAGE_EXTENSION)
+        {
+            images.push_back(it->path());
+        }
+    }
+
+    if (error)
+    {
+        spdlog::error("Could not read batch directory \"{}\": {}", directory, error.message());
+        return 1;
+    }
+
+    if (images.empty())
+    {
+        spdlog::error("No guest images (*{}) found in \"{}\"", SX64_BATCH_IMAGE_EXTENSION, directory);
+        return 1;
+    }
+
+    std::sort(images.begin(), images.end());
+    jobs = std::clamp<unsigned>(jobs, 1, images.size());
+    spdlog::info("Running {} guests on {} threads", images.size(), jobs);
+
+    // Workers pull the next image until none are left, results land in image order
+    std::vector<BatchResult> results(images.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < images.size(); i = next++)
+        {
+            results[i] = runOne(images[i], config);
+            SPDLOG_DEBUG("{} {} after {} cycles", results[i].name, results[i].passed ? "passed" : "failed", results[i].cycles);
+        }
+    };
+
+    auto start = steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    for (std::thread &thread : workers)
+    {
+        thread.join();
+    }
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    for (const BatchResult &result : results)
+    {
+        if (!result.passed)
+        {
+            std::cout << "FAIL " << result.name << ": " << result.reason << "\n";
+            ++failed;
+        }
+    }
+
+    std::cout << results.size() - failed << " of " << results.size() << " passed in " << elapsed << " ms\n";
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <core/machine.hpp>
+#include <string>
+
+#define SX64_BATCH_IMAGE_EXTENSION ".bin"
+#define SX64_BATCH_GOLDEN_EXTENSION ".expected"
+#define SX64_BATCH_DEFAULT_BUDGET 100000000 // Cycles each run gets unless --max-cycles says otherwise
+
+// Runs every <name>.bin in directory as the RAM image of its own machine, jobs machines at a
+// time, and checks the serial output of each against <name>.expected. Returns the exit code.
+int runBatch(const std::string &directory, unsigned jobs, const sx64::MachineConfig &config);
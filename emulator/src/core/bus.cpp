@@ -1,20 +1,27 @@
 #include <spdlog/spdlog.h>
 #include <core/bus.hpp>
-#include <global.hpp>
+#include <core/sx64.hpp>
+#include <algorithm>
 
 Bus::Bus()
+    : decodeRoot(std::make_unique<DecodeNode>()), generation(0)
 {
     spdlog::trace("Bus created");
 }
 
 Bus::~Bus()
 {
+    for (const auto &device : devices)
+    {
+        device->setBus(nullptr);
+    }
     spdlog::trace("Bus destroyed");
 }
 
 void Bus::attachDevice(std::shared_ptr<Device> device)
 {
     devices.push_back(device);
+    device->setBus(this);
     spdlog::trace("Device \"{}\" attached to bus at base address {:#016x}", device->getName(), device->getBaseAddress());
     device->initialize();
     device->enable();
@@ -29,39 +36,138 @@ void Bus::enable()
     }
 }
 
-uint8_t Bus::read(uint64_t address) const
+void Bus::rebuildDecodeTable()
 {
-    spdlog::trace("Bus read at address {:#016x}", address);
+    decodeRoot = std::make_unique<DecodeNode>();
 
     for (const auto &device : devices)
     {
-        uint64_t deviceBaseAddress = device->getBaseAddress();
-        uint64_t deviceSize = device->getSize();
-        if (address >= deviceBaseAddress && address < deviceBaseAddress + deviceSize)
+        if (!device->isEnabled() || device->getSize() == 0)
         {
-            if (device->isEnabled())
-            {
-                uint64_t offset = address - deviceBaseAddress;
-                uint64_t data = device->read(offset);
-                spdlog::trace("Read {:#x} from device \"{}\"", data, device->getName());
-                return data;
-            }
-            else
+            continue;
+        }
+
+        uint64_t start = device->getBaseAddress();
+        uint64_t end = start + device->getSize();
+        if (end < start)
+        {
+            end = UINT64_MAX;
+        }
+
+        // Addresses past the table's reach are resolved by scanning
+        uint64_t limit = 1ULL << SX64_DECODE_ADDRESS_BITS;
+        if (start < limit)
+        {
+            insert(*decodeRoot, SX64_DECODE_LEVELS - 1, 0, device.get(), start, std::min(end, limit));
+        }
+    }
+
+    ++generation;
+    spdlog::trace("Bus decode table rebuilt (generation {})", generation);
+}
+
+void Bus::insert(DecodeNode &node, int level, uint64_t nodeBase, Device *device, uint64_t start, uint64_t end)
+{
+    uint64_t span = 1ULL << (SX64_PAGE_SHIFT + level * SX64_DECODE_BITS);
+    uint64_t nodeEnd = nodeBase + span * node.slots.size();
+
+    uint64_t first = (std::max(start, nodeBase) - nodeBase) / span;
+    uint64_t last = (std::min(end, nodeEnd) - 1 - nodeBase) / span;
+
+    for (uint64_t index = first; index <= last; ++index)
+    {
+        DecodeSlot &slot = node.slots[index];
+        uint64_t slotBase = nodeBase + index * span;
+
+        // Earlier devices win where ranges overlap, as with the linear scan
+        if (slot.device || slot.mixed)
+        {
+            continue;
+        }
+
+        if (start <= slotBase && end - slotBase >= span && !slot.child)
+        {
+            slot.device = device;
+            slot.baseAddress = device->getBaseAddress();
+        }
+        else if (level == 0)
+        {
+            slot.mixed = true;
+        }
+        else
+        {
+            if (!slot.child)
             {
-                spdlog::debug("Device \"{}\" is disabled", device->getName());
+                slot.child = std::make_unique<DecodeNode>();
             }
+            insert(*slot.child, level - 1, slotBase, device, start, end);
         }
     }
+}
 
-    spdlog::warn("No device found for read at address {:#016x}", address);
-    g_cpu.halt();
-    return 0;
+const Bus::DecodeSlot *Bus::lookupSlot(uint64_t address) const
+{
+    if (address >> SX64_DECODE_ADDRESS_BITS)
+    {
+        return nullptr;
+    }
+
+    const DecodeNode *node = decodeRoot.get();
+    for (int level = SX64_DECODE_LEVELS - 1; level >= 0; --level)
+    {
+        const DecodeSlot &slot = node->slots[(address >> (SX64_PAGE_SHIFT + level * SX64_DECODE_BITS)) & (node->slots.size() - 1)];
+        if (slot.device || slot.mixed)
+        {
+            return &slot;
+        }
+
+        if (!slot.child)
+        {
+            return nullptr;
+        }
+
+        node = slot.child.get();
+    }
+
+    return nullptr;
 }
 
-void Bus::write(uint64_t address, uint8_t data)
+Device *Bus::decode(uint64_t address, uint64_t &offset) const
 {
-    spdlog::trace("Bus write at address {:#016x} with data {:#016x}", address, data);
+    if (address >> SX64_DECODE_ADDRESS_BITS)
+    {
+        return scan(address, offset, false);
+    }
+
+    const DecodeSlot *slot = lookupSlot(address);
+    if (!slot)
+    {
+        return nullptr;
+    }
 
+    if (slot->mixed)
+    {
+        return scan(address, offset, false);
+    }
+
+    offset = address - slot->baseAddress;
+    return slot->device;
+}
+
+Device *Bus::decodeSpan(uint64_t address, uint64_t size, uint64_t &offset) const
+{
+    // Only spans that stay inside one device go straight to it
+    Device *device = decode(address, offset);
+    if (device && size <= device->getSize() - offset)
+    {
+        return device;
+    }
+
+    return nullptr;
+}
+
+Device *Bus::scan(uint64_t address, uint64_t &offset, bool verbose) const
+{
     for (const auto &device : devices)
     {
         uint64_t deviceBaseAddress = device->getBaseAddress();
@@ -70,20 +176,253 @@ void Bus::write(uint64_t address, uint8_t data)
         {
             if (device->isEnabled())
             {
-                uint64_t offset = address - deviceBaseAddress;
-                device->write(offset, data);
-                spdlog::trace("Wrote {:#x} to device \"{}\"", data, device->getName());
-                return;
+                offset = address - deviceBaseAddress;
+                return device.get();
             }
-            else
+            else if (verbose)
             {
-                spdlog::debug("Device \"{}\" is disabled", device->getName());
+                SPDLOG_DEBUG("Device \"{}\" is disabled", device->getName());
             }
         }
     }
 
+    return nullptr;
+}
+
+void Bus::haltCurrentCore()
+{
+    // The fault belongs to whichever core made the access, the others keep running
+    if (sx64::CPU *core = sx64::CPU::getCurrent())
+    {
+        sx64::CoreCounters::add(core->getCounters().unmappedHalts);
+        core->halt();
+    }
+}
+
+void Bus::countAccess(const Device *device, bool write)
+{
+    // Only guest accesses count, not the host loading images or snapshots
+    if (sx64::CPU *core = sx64::CPU::getCurrent())
+    {
+        sx64::CoreCounters &counters = core->getCounters();
+        sx64::CoreCounters::add(write ? counters.deviceWrites[device->getStatsSlot()] : counters.deviceReads[device->getStatsSlot()]);
+    }
+}
+
+uint8_t Bus::read(uint64_t address) const
+{
+    SPDLOG_TRACE("Bus read at address {:#016x}", address);
+
+    uint64_t offset;
+    Device *device = decode(address, offset);
+    if (device)
+    {
+        countAccess(device, false);
+        uint64_t data = device->read(offset);
+        SPDLOG_TRACE("Read {:#x} from device \"{}\"", data, device->getName());
+        return data;
+    }
+
+    scan(address, offset, true);
+    spdlog::warn("No device found for read at address {:#016x}", address);
+    haltCurrentCore();
+    return 0;
+}
+
+void Bus::write(uint64_t address, uint8_t data)
+{
+    SPDLOG_TRACE("Bus write at address {:#016x} with data {:#016x}", address, data);
+
+    uint64_t offset;
+    Device *device = decode(address, offset);
+    if (device)
+    {
+        countAccess(device, true);
+        device->write(offset, data);
+        SPDLOG_TRACE("Wrote {:#x} to device \"{}\"", data, device->getName());
+        return;
+    }
+
+    scan(address, offset, true);
     spdlog::warn("No device found for write at address {:#016x}", address);
-    g_cpu.halt();
+    haltCurrentCore();
+}
+
+bool Bus::peek(uint64_t address, uint8_t &data) const
+{
+    uint64_t offset;
+    Device *device = decode(address, offset);
+    if (!device)
+    {
+        return false;
+    }
+
+    data = device->read(offset);
+    return true;
+}
+
+uint64_t Bus::readBytes(uint64_t address, uint64_t size) const
+{
+    uint64_t data = 0;
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        data |= static_cast<uint64_t>(read(address + i)) << (i * 8);
+    }
+    return data;
+}
+
+void Bus::writeBytes(uint64_t address, uint64_t data, uint64_t size)
+{
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        write(address + i, static_cast<uint8_t>(data >> (i * 8)));
+    }
+}
+
+uint16_t Bus::read16(uint64_t address) const
+{
+    SPDLOG_TRACE("Bus read16 at address {:#016x}", address);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, sizeof(uint16_t), offset))
+    {
+        countAccess(device, false);
+        return device->read16(offset);
+    }
+    return static_cast<uint16_t>(readBytes(address, sizeof(uint16_t)));
+}
+
+uint32_t Bus::read32(uint64_t address) const
+{
+    SPDLOG_TRACE("Bus read32 at address {:#016x}", address);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, sizeof(uint32_t), offset))
+    {
+        countAccess(device, false);
+        return device->read32(offset);
+    }
+    return static_cast<uint32_t>(readBytes(address, sizeof(uint32_t)));
+}
+
+uint64_t Bus::read64(uint64_t address) const
+{
+    SPDLOG_TRACE("Bus read64 at address {:#016x}", address);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, sizeof(uint64_t), offset))
+    {
+        countAccess(device, false);
+        return device->read64(offset);
+    }
+    return readBytes(address, sizeof(uint64_t));
+}
+
+void Bus::write16(uint64_t address, uint16_t data)
+{
+    SPDLOG_TRACE("Bus write16 at address {:#016x} with data {:#x}", address, data);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, sizeof(uint16_t), offset))
+    {
+        countAccess(device, true);
+        device->write16(offset, data);
+        return;
+    }
+    writeBytes(address, data, sizeof(uint16_t));
+}
+
+void Bus::write32(uint64_t address, uint32_t data)
+{
+    SPDLOG_TRACE("Bus write32 at address {:#016x} with data {:#x}", address, data);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, sizeof(uint32_t), offset))
+    {
+        countAccess(device, true);
+        device->write32(offset, data);
+        return;
+    }
+    writeBytes(address, data, sizeof(uint32_t));
+}
+
+void Bus::write64(uint64_t address, uint64_t data)
+{
+    SPDLOG_TRACE("Bus write64 at address {:#016x} with data {:#x}", address, data);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, sizeof(uint64_t), offset))
+    {
+        countAccess(device, true);
+        device->write64(offset, data);
+        return;
+    }
+    writeBytes(address, data, sizeof(uint64_t));
+}
+
+void Bus::readBlock(uint64_t address, uint8_t *buffer, uint64_t size) const
+{
+    SPDLOG_TRACE("Bus block read of {} bytes at address {:#016x}", size, address);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, size, offset))
+    {
+        device->readBlock(offset, buffer, size);
+        return;
+    }
+
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        buffer[i] = read(address + i);
+    }
+}
+
+void Bus::writeBlock(uint64_t address, const uint8_t *buffer, uint64_t size)
+{
+    SPDLOG_TRACE("Bus block write of {} bytes at address {:#016x}", size, address);
+
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, size, offset))
+    {
+        device->writeBlock(offset, buffer, size);
+        return;
+    }
+
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        write(address + i, buffer[i]);
+    }
+}
+
+bool Bus::peekBlock(uint64_t address, uint8_t *buffer, uint64_t size) const
+{
+    uint64_t offset;
+    if (Device *device = decodeSpan(address, size, offset))
+    {
+        device->readBlock(offset, buffer, size);
+        return true;
+    }
+
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        if (!peek(address + i, buffer[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t *Bus::translate(uint64_t address, bool write) const
+{
+    // Only pages owned whole by one device can be handed out, mixed pages stay on the bus
+    const DecodeSlot *slot = lookupSlot(address);
+    if (!slot || !slot->device)
+    {
+        return nullptr;
+    }
+
+    return slot->device->getHostPointer((address & ~(SX64_PAGE_SIZE - 1)) - slot->baseAddress, write);
 }
 
 const std::vector<std::shared_ptr<Device>> &Bus::getDevices() const
@@ -3,8 +3,15 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <array>
 #include "device.hpp"
 
+#define SX64_PAGE_SHIFT 12
+#define SX64_PAGE_SIZE (1ULL << SX64_PAGE_SHIFT)
+#define SX64_DECODE_LEVELS 4
+#define SX64_DECODE_BITS 9
+#define SX64_DECODE_ADDRESS_BITS (SX64_PAGE_SHIFT + SX64_DECODE_LEVELS * SX64_DECODE_BITS)
+
 class Bus
 {
 public:
@@ -14,9 +21,54 @@ public:
     void attachDevice(std::shared_ptr<Device> device);
     uint8_t read(uint64_t address) const;
     void write(uint64_t address, uint8_t data);
+    bool peek(uint64_t address, uint8_t &data) const;
+    uint16_t read16(uint64_t address) const;
+    uint32_t read32(uint64_t address) const;
+    uint64_t read64(uint64_t address) const;
+    void write16(uint64_t address, uint16_t data);
+    void write32(uint64_t address, uint32_t data);
+    void write64(uint64_t address, uint64_t data);
+    void readBlock(uint64_t address, uint8_t *buffer, uint64_t size) const;
+    void writeBlock(uint64_t address, const uint8_t *buffer, uint64_t size);
+    bool peekBlock(uint64_t address, uint8_t *buffer, uint64_t size) const;
+    uint8_t *translate(uint64_t address, bool write) const;
     const std::vector<std::shared_ptr<Device>> &getDevices() const;
     void enable();
+    void rebuildDecodeTable();
+
+    // Changes whenever the decode table is rebuilt
+    uint64_t getGeneration() const
+    {
+        return generation;
+    }
 
 private:
+    // Radix table over address pages. A slot either maps its whole range to one
+    // device, points at the next level, or is mixed and falls back to a scan.
+    struct DecodeNode;
+    struct DecodeSlot
+    {
+        Device *device = nullptr;
+        uint64_t baseAddress = 0;
+        std::unique_ptr<DecodeNode> child;
+        bool mixed = false;
+    };
+    struct DecodeNode
+    {
+        std::array<DecodeSlot, 1 << SX64_DECODE_BITS> slots;
+    };
+
+    static void haltCurrentCore();
+    static void countAccess(const Device *device, bool write);
+    const DecodeSlot *lookupSlot(uint64_t address) const;
+    Device *decode(uint64_t address, uint64_t &offset) const;
+    Device *decodeSpan(uint64_t address, uint64_t size, uint64_t &offset) const;
+    Device *scan(uint64_t address, uint64_t &offset, bool verbose) const;
+    uint64_t readBytes(uint64_t address, uint64_t size) const;
+    void writeBytes(uint64_t address, uint64_t data, uint64_t size);
+    void insert(DecodeNode &node, int level, uint64_t nodeBase, Device *device, uint64_t start, uint64_t end);
+
     std::vector<std::shared_ptr<Device>> devices;
+    std::unique_ptr<DecodeNode> decodeRoot;
+    uint64_t generation;
 };
@@ -0,0 +1,454 @@
+#include <core/decoder.hpp>
+#include <core/sx64.hpp>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cstring>
+
+namespace sx64
+{
+    uint8_t instructionLength(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case InstructionType::WRITE:
+        case InstructionType::READ:
+        case InstructionType::LDI:
+            return 10;
+
+        case InstructionType::ADD:
+        case InstructionType::SUB:
+        case InstructionType::MUL:
+        case InstructionType::DIV:
+        case InstructionType::CMP:
+            return 3;
+
+        case InstructionType::PUSH:
+        case InstructionType::POP:
+            return 2;
+
+        case InstructionType::JMP:
+        case InstructionType::JE:
+        case InstructionType::JNE:
+            return 9;
+
+        case InstructionType::LD8:
+        case InstructionType::LD16:
+        case InstructionType::LD32:
+        case InstructionType::LD64:
+        case InstructionType::ST8:
+        case InstructionType::ST16:
+        case InstructionType::ST32:
+        case InstructionType::ST64:
+            return 11;
+
+        default:
+            return 1;
+        }
+    }
+
+    uint8_t instructionCycles(uint8_t opcode)
+    {
+        // One cycle per byte fetched, plus the cost of executing it
+        uint8_t execute;
+        switch (opcode)
+        {
+        case InstructionType::WRITE:
+        case InstructionType::READ:
+        case InstructionType::PUSH:
+        case InstructionType::POP:
+        case InstructionType::LD8:
+        case InstructionType::LD16:
+        case InstructionType::LD32:
+        case InstructionType::LD64:
+        case InstructionType::ST8:
+        case InstructionType::ST16:
+        case InstructionType::ST32:
+        case InstructionType::ST64:
+            execute = 2;
+            break;
+
+        case InstructionType::ADD:
+        case InstructionType::SUB:
+        case InstructionType::CMP:
+        case InstructionType::JMP:
+        case InstructionType::JE:
+        case InstructionType::JNE:
+            execute = 1;
+            break;
+
+        case InstructionType::MUL:
+            execute = 4;
+            break;
+
+        case InstructionType::DIV:
+            execute = 16;
+            break;
+
+        default:
+            execute = 0;
+            break;
+        }
+
+        return instructionLength(opcode) + execute;
+    }
+
+    const char *instructionName(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case InstructionType::NOP:
+            return "NOP";
+        case InstructionType::HLT:
+            return "HLT";
+        case InstructionType::WRITE:
+            return "WRITE";
+        case InstructionType::READ:
+            return "READ";
+        case InstructionType::LDI:
+            return "LDI";
+        case InstructionType::ADD:
+            return "ADD";
+        case InstructionType::SUB:
+            return "SUB";
+        case InstructionType::MUL:
+            return "MUL";
+        case InstructionType::DIV:
+            return "DIV";
+        case InstructionType::PUSH:
+            return "PUSH";
+        case InstructionType::POP:
+            return "POP";
+        case InstructionType::JMP:
+            return "JMP";
+        case InstructionType::CMP:
+            return "CMP";
+        case InstructionType::JE:
+            return "JE";
+        case InstructionType::JNE:
+            return "JNE";
+        case InstructionType::LD8:
+            return "LD8";
+        case InstructionType::LD16:
+            return "LD16";
+        case InstructionType::LD32:
+            return "LD32";
+        case InstructionType::LD64:
+            return "LD64";
+        case InstructionType::ST8:
+            return "ST8";
+        case InstructionType::ST16:
+            return "ST16";
+        case InstructionType::ST32:
+            return "ST32";
+        case InstructionType::ST64:
+            return "ST64";
+        default:
+            return nullptr;
+        }
+    }
+
+    uint8_t accessSize(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case InstructionType::LD8:
+        case InstructionType::ST8:
+            return 1;
+        case InstructionType::LD16:
+        case InstructionType::ST16:
+            return 2;
+        case InstructionType::LD32:
+        case InstructionType::ST32:
+            return 4;
+        case InstructionType::LD64:
+        case InstructionType::ST64:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    bool isBlockTerminator(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case InstructionType::NOP:
+        case InstructionType::WRITE:
+        case InstructionType::READ:
+        case InstructionType::LDI:
+        case InstructionType::ADD:
+        case InstructionType::SUB:
+        case InstructionType::MUL:
+        case InstructionType::DIV:
+        case InstructionType::PUSH:
+        case InstructionType::POP:
+        case InstructionType::CMP:
+        case InstructionType::LD8:
+        case InstructionType::LD16:
+        case InstructionType::LD32:
+        case InstructionType::LD64:
+        case InstructionType::ST8:
+        case InstructionType::ST16:
+        case InstructionType::ST32:
+        case InstructionType::ST64:
+            return false;
+
+        default:
+            return true;
+        }
+    }
+
+    bool decodeInstruction(const Bus &bus, uint64_t address, DecodedInstruction &instruction)
+    {
+        uint8_t buffer[SX64_MAX_INSTRUCTION_LENGTH];
+        const uint8_t *bytes = buffer;
+        uint64_t pageOffset = address & (SX64_PAGE_SIZE - 1);
+        const uint8_t *host = bus.translate(address, false);
+
+        uint8_t length;
+        if (host && SX64_PAGE_SIZE - pageOffset >= sizeof(buffer))
+        {
+            // Straight from host memory when the longest instruction cannot leave the page
+            bytes = host + pageOffset;
+            length = instructionLength(bytes[0]);
+        }
+        else
+        {
+            if (!bus.peek(address, buffer[0]))
+            {
+                return false;
+            }
+
+            length = instructionLength(buffer[0]);
+            if (length > 1 && !bus.peekBlock(address + 1, buffer + 1, length - 1))
+            {
+                return false;
+            }
+        }
+
+        auto operandAt = [bytes](size_t offset)
+        {
+            uint64_t value;
+            std::memcpy(&value, bytes + offset, sizeof(value));
+            return value;
+        };
+
+        instruction = DecodedInstruction{address, 0, bytes[0], 0, 0, length, instructionCycles(bytes[0])};
+
+        switch (bytes[0])
+        {
+        case InstructionType::WRITE:
+        case InstructionType::READ:
+        case InstructionType::LDI:
+            instruction.reg1 = bytes[1];
+            instruction.operand = operandAt(2);
+            break;
+
+        case InstructionType::ADD:
+        case InstructionType::SUB:
+        case InstructionType::MUL:
+        case InstructionType::DIV:
+        case InstructionType::CMP:
+            instruction.reg1 = bytes[1];
+            instruction.reg2 = bytes[2];
+            break;
+
+        case InstructionType::PUSH:
+        case InstructionType::POP:
+            instruction.reg1 = bytes[1];
+            break;
+
+        case InstructionType::JMP:
+        case InstructionType::JE:
+        case InstructionType::JNE:
+            instruction.operand = operandAt(1);
+            break;
+
+        case InstructionType::LD8:
+        case InstructionType::LD16:
+        case InstructionType::LD32:
+        case InstructionType::LD64:
+        case InstructionType::ST8:
+        case InstructionType::ST16:
+        case InstructionType::ST32:
+        case InstructionType::ST64:
+            instruction.reg1 = bytes[1]; // Loaded or stored
+            instruction.reg2 = bytes[2]; // Base
+            instruction.operand = operandAt(3);
+            break;
+
+        default:
+            break;
+        }
+
+        return true;
+    }
+
+    void fuseInstructions(BasicBlock &block)
+    {
+        auto &instructions = block.instructions;
+        for (size_t i = 0; i + 1 < instructions.size(); ++i)
+        {
+            DecodedInstruction &first = instructions[i];
+            const DecodedInstruction &second = instructions[i + 1];
+
+            // Only valid registers, so a fault still comes from the instruction that caused it
+            if (first.opcode == InstructionType::LDI && second.opcode == InstructionType::WRITE && first.reg1 == second.reg1 && first.reg1 < 8)
+            {
+                first.fusion = Fusion::StoreImmediate;
+            }
+            else if (first.opcode == InstructionType::CMP && (second.opcode == InstructionType::JE || second.opcode == InstructionType::JNE) && first.reg1 < 8 && first.reg2 < 8)
+            {
+                first.fusion = Fusion::CompareBranch;
+            }
+            else
+            {
+                continue;
+            }
+
+            ++i; // Pairs do not overlap
+        }
+    }
+
+    const BasicBlock *InstructionCache::find(uint64_t address) const
+    {
+        auto it = blocks.find(address);
+        return it != blocks.end() ? it->second.get() : nullptr;
+    }
+
+    const BasicBlock *InstructionCache::decode(const Bus &bus, uint64_t address)
+    {
+        auto block = std::make_unique<BasicBlock>();
+        block->startAddress = address;
+        block->endAddress = address;
+
+        DecodedInstruction instruction;
+        while (block->instructions.size() < SX64_MAX_BLOCK_INSTRUCTIONS && decodeInstruction(bus, block->endAddress, instruction))
+        {
+            block->instructions.push_back(instruction);
+            block->endAddress += instruction.length;
+
+            if (isBlockTerminator(instruction.opcode))
+            {
+                break;
+            }
+        }
+
+        if (block->instructions.empty())
+        {
+            return nullptr;
+        }
+        fuseInstructions(*block);
+
+        for (size_t i = 0; i + 1 < block->instructions.size(); ++i)
+        {
+            switch (block->instructions[i + 1].opcode)
+            {
+            case InstructionType::ADD:
+            case InstructionType::SUB:
+            case InstructionType::MUL:
+            case InstructionType::CMP:
+                block->instructions[i].flagsOverwritten = true;
+                break;
+            }
+        }
+
+        for (const DecodedInstruction &decoded : block->instructions)
+        {
+            auto used = block->retired.begin() + block->retiredOpcodes;
+            auto it = std::find_if(block->retired.begin(), used, [&](const auto &entry) { return entry.first == decoded.opcode; });
+            if (it == used)
+            {
+                *it = {decoded.opcode, 0};
+                ++block->retiredOpcodes;
+            }
+            ++it->second;
+            block->cycles += decoded.cycles;
+        }
+
+        for (uint64_t page = block->startAddress >> SX64_PAGE_SHIFT; page <= (block->endAddress - 1) >> SX64_PAGE_SHIFT; ++page)
+        {
+            pageBlocks[page].push_back(address);
+        }
+
+        SPDLOG_TRACE("Decoded block {:#016x} -> {:#016x} ({} instructions)", block->startAddress, block->endAddress, block->instructions.size());
+
+        const BasicBlock *result = block.get();
+        blocks[address] = std::move(block);
+        return result;
+    }
+
+    bool InstructionCache::invalidate(uint64_t address, uint64_t size)
+    {
+        std::vector<uint64_t> hit;
+        for (uint64_t page = address >> SX64_PAGE_SHIFT; page <= (address + size - 1) >> SX64_PAGE_SHIFT; ++page)
+        {
+            auto pageIt = pageBlocks.find(page);
+            if (pageIt == pageBlocks.end())
+            {
+                continue;
+            }
+
+            // A block spanning both pages is listed under each
+            for (uint64_t startAddress : pageIt->second)
+            {
+                const BasicBlock &block = *blocks.at(startAddress);
+                if (address < block.endAddress && address + size > block.startAddress &&
+                    std::find(hit.begin(), hit.end(), startAddress) == hit.end())
+                {
+                    hit.push_back(startAddress);
+                }
+            }
+        }
+
+        for (uint64_t startAddress : hit)
+        {
+            SPDLOG_TRACE("Write to {:#016x} invalidated block {:#016x}", address, startAddress);
+            unlinkBlock(startAddress);
+        }
+
+        return !hit.empty();
+    }
+
+    void InstructionCache::unlinkBlock(uint64_t startAddress)
+    {
+        auto it = blocks.find(startAddress);
+        const BasicBlock &block = *it->second;
+
+        for (uint64_t page = block.startAddress >> SX64_PAGE_SHIFT; page <= (block.endAddress - 1) >> SX64_PAGE_SHIFT; ++page)
+        {
+            auto pageIt = pageBlocks.find(page);
+            auto &starts = pageIt->second;
+            starts.erase(std::remove(starts.begin(), starts.end(), startAddress), starts.end());
+            if (starts.empty())
+            {
+                pageBlocks.erase(pageIt);
+            }
+        }
+
+        retired.push_back(std::move(it->second));
+        blocks.erase(it);
+        ++epoch;
+    }
+
+    void InstructionCache::flush()
+    {
+        for (auto &entry : blocks)
+        {
+            retired.push_back(std::move(entry.second));
+        }
+        blocks.clear();
+        pageBlocks.clear();
+        ++epoch;
+    }
+
+    void InstructionCache::releaseRetired()
+    {
+        retired.clear();
+    }
+
+    size_t InstructionCache::size() const
+    {
+        return blocks.size();
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <core/bus.hpp>
+
+#define SX64_MAX_BLOCK_INSTRUCTIONS 64
+#define SX64_MAX_INSTRUCTION_CYCLES 32
+#define SX64_MAX_INSTRUCTION_LENGTH 11 // LD and ST: opcode, register, base register, 64-bit displacement
+#define SX64_MAX_BLOCK_CYCLES (SX64_MAX_BLOCK_INSTRUCTIONS * SX64_MAX_INSTRUCTION_CYCLES)
+
+namespace sx64
+{
+    // Pairs of instructions the threaded engine runs as one operation, marked on the first of the two
+    enum class Fusion : uint8_t
+    {
+        None,
+        StoreImmediate, // LDI r, imm followed by WRITE r, address
+        CompareBranch   // CMP ra, rb followed by JE or JNE
+    };
+
+    struct DecodedInstruction
+    {
+        uint64_t address; // Guest address of the opcode byte
+        uint64_t operand; // Immediate value or absolute address
+        uint8_t opcode;
+        uint8_t reg1;
+        uint8_t reg2;
+        uint8_t length; // Encoded size in bytes
+        uint8_t cycles; // Emulated clock cycles, fetch included
+        Fusion fusion = Fusion::None;
+        bool flagsOverwritten = false; // The next instruction in the block sets every flag again
+    };
+
+    struct BasicBlock
+    {
+        // Block run next, valid while the cache's epoch is the one it was made in
+        struct Link
+        {
+            const BasicBlock *block = nullptr;
+            uint64_t epoch = 0;
+        };
+
+        uint64_t startAddress;
+        uint64_t endAddress; // Exclusive
+        std::vector<DecodedInstruction> instructions;
+        std::array<std::pair<uint8_t, uint8_t>, SX64_MAX_BLOCK_INSTRUCTIONS> retired; // Instructions by opcode, counted at once when the whole block runs
+        uint8_t retiredOpcodes = 0;                                                   // Entries used in retired
+        uint64_t cycles = 0;                                                          // All instructions together
+        mutable std::array<Link, 2> successors;                                       // Falling through and jumping, for the threaded engine
+    };
+
+    uint8_t instructionLength(uint8_t opcode);
+    uint8_t instructionCycles(uint8_t opcode);
+    const char *instructionName(uint8_t opcode); // nullptr for opcodes the CPU does not know
+    uint8_t accessSize(uint8_t opcode);          // Bytes moved by LD and ST, 0 for other opcodes
+    bool isBlockTerminator(uint8_t opcode);
+    bool decodeInstruction(const Bus &bus, uint64_t address, DecodedInstruction &instruction);
+    void fuseInstructions(BasicBlock &block);
+
+    class InstructionCache
+    {
+    public:
+        const BasicBlock *find(uint64_t address) const;
+        const BasicBlock *decode(const Bus &bus, uint64_t address);
+        bool invalidate(uint64_t address, uint64_t size = 1);
+        void flush();
+        void releaseRetired();
+        size_t size() const;
+
+        // Changes whenever a block is dropped
+        uint64_t getEpoch() const
+        {
+            return epoch;
+        }
+
+    private:
+        void unlinkBlock(uint64_t startAddress);
+
+        std::unordered_map<uint64_t, std::unique_ptr<BasicBlock>> blocks;   // Keyed by block start address
+        std::unordered_map<uint64_t, std::vector<uint64_t>> pageBlocks;     // Page number -> block start addresses
+        std::vector<std::unique_ptr<BasicBlock>> retired;                  // Invalidated blocks that may still be executing
+        uint64_t epoch = 1;
+    };
+}
@@ -1,8 +1,10 @@
 #include <spdlog/spdlog.h>
 #include <core/device.hpp>
+#include <core/bus.hpp>
+#include <core/stats.hpp>
 
 Device::Device(const std::string &name, bool readOnly, uint64_t baseAddress)
-    : name(name), enabled(true), baseAddress(baseAddress), readOnly(readOnly)
+    : name(name), enabled(true), baseAddress(baseAddress), bus(nullptr), readOnly(readOnly), statsSlot(sx64::Stats::deviceSlot(name))
 {
     spdlog::trace("Device \"{}\" created (Permissions {}, Base Address {:#016x})", name, getPermissionStr(), baseAddress);
 }
@@ -40,6 +42,89 @@ void Device::write([[maybe_unused]] uint64_t address, [[maybe_unused]] uint8_t d
     }
 }
 
+uint16_t Device::read16(uint64_t address) const
+{
+    return static_cast<uint16_t>(read(address)) | static_cast<uint16_t>(read(address + 1)) << 8;
+}
+
+uint32_t Device::read32(uint64_t address) const
+{
+    return static_cast<uint32_t>(read16(address)) | static_cast<uint32_t>(read16(address + 2)) << 16;
+}
+
+uint64_t Device::read64(uint64_t address) const
+{
+    return static_cast<uint64_t>(read32(address)) | static_cast<uint64_t>(read32(address + 4)) << 32;
+}
+
+void Device::write16(uint64_t address, uint16_t data)
+{
+    write(address, static_cast<uint8_t>(data));
+    write(address + 1, static_cast<uint8_t>(data >> 8));
+}
+
+void Device::write32(uint64_t address, uint32_t data)
+{
+    write16(address, static_cast<uint16_t>(data));
+    write16(address + 2, static_cast<uint16_t>(data >> 16));
+}
+
+void Device::write64(uint64_t address, uint64_t data)
+{
+    write32(address, static_cast<uint32_t>(data));
+    write32(address + 4, static_cast<uint32_t>(data >> 32));
+}
+
+void Device::readBlock(uint64_t address, uint8_t *buffer, uint64_t size) const
+{
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        buffer[i] = read(address + i);
+    }
+}
+
+void Device::writeBlock(uint64_t address, const uint8_t *buffer, uint64_t size)
+{
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        write(address + i, buffer[i]);
+    }
+}
+
+uint8_t *Device::getHostPointer([[maybe_unused]] uint64_t address, [[maybe_unused]] bool write)
+{
+    return nullptr;
+}
+
+uint64_t *Device::getDirtyBitmap()
+{
+    return nullptr;
+}
+
+bool Device::saveState([[maybe_unused]] sx64::SnapshotWriter &writer) const
+{
+    return true;
+}
+
+bool Device::loadState([[maybe_unused]] sx64::SnapshotReader &reader)
+{
+    return true;
+}
+
+bool Device::saveDelta(sx64::SnapshotWriter &writer) const
+{
+    return saveState(writer);
+}
+
+bool Device::loadDelta(sx64::SnapshotReader &reader)
+{
+    return loadState(reader);
+}
+
+void Device::checkpoint()
+{
+}
+
 std::string Device::getName() const
 {
     return name;
@@ -58,11 +143,19 @@ bool Device::isEnabled() const
 void Device::enable()
 {
     enabled = true;
+    if (bus)
+    {
+        bus->rebuildDecodeTable();
+    }
 }
 
 void Device::disable()
 {
     enabled = false;
+    if (bus)
+    {
+        bus->rebuildDecodeTable();
+    }
 }
 
 uint64_t Device::getBaseAddress() const
@@ -73,4 +166,14 @@ uint64_t Device::getBaseAddress() const
 bool Device::isReadOnly() const
 {
     return readOnly;
-}
\ No newline at end of file
+}
+
+void Device::setBus(Bus *bus)
+{
+    this->bus = bus;
+}
+
+uint32_t Device::getStatsSlot() const
+{
+    return statsSlot;
+}
@@ -4,6 +4,14 @@
 #include <string>
 #include <memory>
 
+class Bus;
+
+namespace sx64
+{
+    class SnapshotWriter;
+    class SnapshotReader;
+}
+
 class Device
 {
 public:
@@ -16,8 +24,35 @@ public:
     virtual uint8_t read(uint64_t address) const;
     virtual void write(uint64_t address, uint8_t data);
 
+    // Sized and span accesses, little-endian. The defaults go through the byte path.
+    virtual uint16_t read16(uint64_t address) const;
+    virtual uint32_t read32(uint64_t address) const;
+    virtual uint64_t read64(uint64_t address) const;
+    virtual void write16(uint64_t address, uint16_t data);
+    virtual void write32(uint64_t address, uint32_t data);
+    virtual void write64(uint64_t address, uint64_t data);
+    virtual void readBlock(uint64_t address, uint8_t *buffer, uint64_t size) const;
+    virtual void writeBlock(uint64_t address, const uint8_t *buffer, uint64_t size);
+
     virtual uint64_t getSize() const = 0;
 
+    // Host memory backing the device from address to its end, or nullptr when accesses
+    // have to go through read/write. Valid until the device is disabled. A writable pointer
+    // counts the page at address as written.
+    virtual uint8_t *getHostPointer(uint64_t address, bool write);
+
+    // One bit per page, for writers that keep a host pointer across checkpoints to mark the
+    // pages they write. nullptr when the device does not track writes.
+    virtual uint64_t *getDirtyBitmap();
+
+    // Device contents for machine snapshots. Devices without state save nothing, devices
+    // without a cheaper delta save their whole state in delta snapshots too.
+    virtual bool saveState(sx64::SnapshotWriter &writer) const;
+    virtual bool loadState(sx64::SnapshotReader &reader);
+    virtual bool saveDelta(sx64::SnapshotWriter &writer) const;
+    virtual bool loadDelta(sx64::SnapshotReader &reader);
+    virtual void checkpoint(); // The state just saved or restored is the base of the next delta
+
     std::string getName() const;
     std::string getPermissionStr() const;
     bool isEnabled() const;
@@ -25,12 +60,16 @@ public:
     void disable();
     uint64_t getBaseAddress() const;
     bool isReadOnly() const;
+    void setBus(Bus *bus);
+    uint32_t getStatsSlot() const; // Index of the device's bus access counters
 
 protected:
     std::string name;
     bool enabled;
     uint64_t baseAddress;
+    Bus *bus; // Bus the device is attached to, told when the device is enabled or disabled
 
 private:
     bool readOnly;
+    uint32_t statsSlot;
 };
@@ -0,0 +1,1156 @@
+#include <core/jit.hpp>
+#include <core/sx64.hpp>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <array>
+
+namespace sx64
+{
+#if defined(__x86_64__)
+    namespace
+    {
+        enum Register
+        {
+            RAX = 0,
+            RCX = 1,
+            RDX = 2,
+            RBX = 3,
+            RSP = 4,
+            RBP = 5,
+            RSI = 6,
+            RDI = 7,
+            R12 = 12,
+            R13 = 13,
+            R14 = 14,
+            R15 = 15
+        };
+
+        enum Condition
+        {
+            CC_O = 0x0,
+            CC_B = 0x2,
+            CC_AE = 0x3,
+            CC_E = 0x4,
+            CC_NE = 0x5,
+            CC_S = 0x8,
+            CC_GE = 0xD
+        };
+
+        enum Group1
+        {
+            GROUP1_ADD = 0,
+            GROUP1_SUB = 5,
+            GROUP1_CMP = 7
+        };
+
+        // Minimal x86-64 encoder for the handful of forms the translator emits. Positions are
+        // addresses in the executable view of the code cache, bytes go to the writable view.
+        class Emitter
+        {
+        public:
+            Emitter(uint8_t *code, ptrdiff_t writable) : code(code), writable(writable) {}
+
+            uint8_t *position() const { return code; }
+
+            void byte(uint8_t value) { *(code++ + writable) = value; }
+
+            void dword(uint32_t value)
+            {
+                std::memcpy(code + writable, &value, sizeof(value));
+                code += sizeof(value);
+            }
+
+            void qword(uint64_t value)
+            {
+                std::memcpy(code + writable, &value, sizeof(value));
+                code += sizeof(value);
+            }
+
+            void rex(bool wide, int reg, int index, int base, bool byteRegister = false)
+            {
+                uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((index & 8) ? 0x02 : 0) | ((base & 8) ? 0x01 : 0);
+                if (prefix != 0x40 || (byteRegister && reg >= RSP))
+                {
+                    byte(prefix);
+                }
+            }
+
+            // [base + disp32]
+            void memory(int reg, int base, int32_t displacement)
+            {
+                byte(0x80 | ((reg & 7) << 3) | (base & 7));
+                if ((base & 7) == RSP)
+                {
+                    byte(0x24);
+                }
+                dword(static_cast<uint32_t>(displacement));
+            }
+
+            // [base + index]
+            void memoryIndexed(int reg, int base, int index)
+            {
+                byte(0x44 | ((reg & 7) << 3));
+                byte(((index & 7) << 3) | (base & 7));
+                byte(0);
+            }
+
+            void direct(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+            void movImmediate(int reg, uint64_t value)
+            {
+                rex(true, 0, 0, reg);
+                byte(0xB8 + (reg & 7));
+                qword(value);
+            }
+
+            void movLoad(int reg, int base, int32_t displacement)
+            {
+                rex(true, reg, 0, base);
+                byte(0x8B);
+                memory(reg, base, displacement);
+            }
+
+            void movStore(int base, int32_t displacement, int reg)
+            {
+                rex(true, reg, 0, base);
+                byte(0x89);
+                memory(reg, base, displacement);
+            }
+
+            void movRegister(int destination, int source)
+            {
+                rex(true, source, 0, destination);
+                byte(0x89);
+                direct(source, destination);
+            }
+
+            // add/sub/cmp reg, [base + disp32]
+            void arithmeticLoad(uint8_t opcode, int reg, int base, int32_t displacement)
+            {
+                rex(true, reg, 0, base);
+                byte(opcode);
+                memory(reg, base, displacement);
+            }
+
+            void imulLoad(int reg, int base, int32_t displacement)
+            {
+                rex(true, reg, 0, base);
+                byte(0x0F);
+                byte(0xAF);
+                memory(reg, base, displacement);
+            }
+
+            void divMemory(int base, int32_t displacement)
+            {
+                rex(true, 0, 0, base);
+                byte(0xF7);
+                memory(6, base, displacement);
+            }
+
+            void group1Immediate(Group1 operation, int reg, int32_t value)
+            {
+                rex(true, 0, 0, reg);
+                byte(0x81);
+                direct(operation, reg);
+                dword(static_cast<uint32_t>(value));
+            }
+
+            void group1MemoryImmediate8(Group1 operation, int base, int32_t displacement, int8_t value)
+            {
+                rex(true, 0, 0, base);
+                byte(0x83);
+                memory(operation, base, displacement);
+                byte(static_cast<uint8_t>(value));
+            }
+
+            void subRegister(int destination, int source)
+            {
+                rex(true, source, 0, destination);
+                byte(0x29);
+                direct(source, destination);
+            }
+
+            void cmpRegister(int left, int right)
+            {
+                rex(true, right, 0, left);
+                byte(0x39);
+                direct(right, left);
+            }
+
+            void testRegister(int reg)
+            {
+                rex(true, reg, 0, reg);
+                byte(0x85);
+                direct(reg, reg);
+            }
+
+            void testByteRegister(int reg)
+            {
+                byte(0x84);
+                direct(reg, reg);
+            }
+
+            void cmpByteMemoryImmediate(int base, int32_t displacement, uint8_t value)
+            {
+                rex(false, 0, 0, base);
+                byte(0x80);
+                memory(7, base, displacement);
+                byte(value);
+            }
+
+            void cmpByteIndexedImmediate(int base, int index, uint8_t value)
+            {
+                rex(false, 0, index, base);
+                byte(0x80);
+                memoryIndexed(7, base, index);
+                byte(value);
+            }
+
+            // Locked, other cores set bits in the same bitmap words
+            void lockOrByteMemoryImmediate(int base, int32_t displacement, uint8_t value)
+            {
+                byte(0xF0);
+                rex(false, 0, 0, base);
+                byte(0x80);
+                memory(1, base, displacement);
+                byte(value);
+            }
+
+            // Copies bit index of the bit string at [base] to the carry flag
+            void btMemoryRegister(int base, int index)
+            {
+                rex(true, index, 0, base);
+                byte(0x0F);
+                byte(0xA3);
+                memory(index, base, 0);
+            }
+
+            // Sets bit index of the bit string at [base], locked like lockOrByteMemoryImmediate
+            void lockBtsMemoryRegister(int base, int index)
+            {
+                byte(0xF0);
+                rex(true, index, 0, base);
+                byte(0x0F);
+                byte(0xAB);
+                memory(index, base, 0);
+            }
+
+            void testByteMemoryImmediate(int base, int32_t displacement, uint8_t value)
+            {
+                rex(false, 0, 0, base);
+                byte(0xF6);
+                memory(0, base, displacement);
+                byte(value);
+            }
+
+            void movzxByteLoad(int reg, int base, int32_t displacement)
+            {
+                rex(false, reg, 0, base);
+                byte(0x0F);
+                byte(0xB6);
+                memory(reg, base, displacement);
+            }
+
+            void movzxByteIndexed(int reg, int base, int index)
+            {
+                rex(false, reg, index, base);
+                byte(0x0F);
+                byte(0xB6);
+                memoryIndexed(reg, base, index);
+            }
+
+            void movzxWordLoad(int reg, int base, int32_t displacement)
+            {
+                rex(false, reg, 0, base);
+                byte(0x0F);
+                byte(0xB7);
+                memory(reg, base, displacement);
+            }
+
+            void movzxByteRegister(int destination, int source)
+            {
+                byte(0x0F);
+                byte(0xB6);
+                direct(destination, source);
+            }
+
+            void storeByte(int base, int32_t displacement, int reg)
+            {
+                rex(false, reg, 0, base, true);
+                byte(0x88);
+                memory(reg, base, displacement);
+            }
+
+            void storeByteIndexed(int base, int index, int reg)
+            {
+                rex(false, reg, index, base, true);
+                byte(0x88);
+                memoryIndexed(reg, base, index);
+            }
+
+            void storeWord(int base, int32_t displacement, int reg)
+            {
+                byte(0x66);
+                rex(false, reg, 0, base);
+                byte(0x89);
+                memory(reg, base, displacement);
+            }
+
+            void setCondition(Condition condition, int reg)
+            {
+                byte(0x0F);
+                byte(0x90 | condition);
+                direct(0, reg);
+            }
+
+            void shiftRightImmediate(int reg, uint8_t count)
+            {
+                rex(true, 0, 0, reg);
+                byte(0xC1);
+                direct(5, reg);
+                byte(count);
+            }
+
+            void shiftLeftByteOnce(int reg)
+            {
+                byte(0xD0);
+                direct(4, reg);
+            }
+
+            void orByteRegister(int destination, int source)
+            {
+                byte(0x08);
+                direct(source, destination);
+            }
+
+            void orRegister32(int destination, int source)
+            {
+                byte(0x09);
+                direct(source, destination);
+            }
+
+            void andEaxImmediate(uint32_t value)
+            {
+                byte(0x25);
+                dword(value);
+            }
+
+            void xorEdxEdx()
+            {
+                byte(0x31);
+                byte(0xD2);
+            }
+
+            void push(int reg)
+            {
+                if (reg & 8)
+                {
+                    byte(0x41);
+                }
+                byte(0x50 + (reg & 7));
+            }
+
+            void pop(int reg)
+            {
+                if (reg & 8)
+                {
+                    byte(0x41);
+                }
+                byte(0x58 + (reg & 7));
+            }
+
+            void callRegister(int reg)
+            {
+                byte(0xFF);
+                direct(2, reg);
+            }
+
+            void jmpRegister(int reg)
+            {
+                byte(0xFF);
+                direct(4, reg);
+            }
+
+            void ret() { byte(0xC3); }
+
+            // Forward jumps return the displacement field to bind() later
+            uint8_t *jmp32()
+            {
+                byte(0xE9);
+                uint8_t *site = code;
+                dword(0);
+                return site;
+            }
+
+            uint8_t *jcc32(Condition condition)
+            {
+                byte(0x0F);
+                byte(0x80 | condition);
+                uint8_t *site = code;
+                dword(0);
+                return site;
+            }
+
+            uint8_t *jcc8(Condition condition)
+            {
+                byte(0x70 | condition);
+                uint8_t *site = code;
+                byte(0);
+                return site;
+            }
+
+            void jmpTo(const uint8_t *target)
+            {
+                byte(0xE9);
+                dword(static_cast<uint32_t>(target - (code + 4)));
+            }
+
+            void bind(uint8_t *site) { patch(site, code, writable); }
+
+            void bind8(uint8_t *site) { site[writable] = static_cast<uint8_t>(code - (site + 1)); }
+
+            static void patch(uint8_t *site, const uint8_t *target, ptrdiff_t writable)
+            {
+                uint32_t displacement = static_cast<uint32_t>(target - (site + 4));
+                std::memcpy(site + writable, &displacement, sizeof(displacement));
+            }
+
+        private:
+            uint8_t *code;
+            ptrdiff_t writable; // Writable view minus executable view
+        };
+
+        int32_t registerSlot(uint8_t index)
+        {
+            return static_cast<int32_t>(index * sizeof(uint64_t));
+        }
+    }
+#endif
+
+    Jit::Jit(CPU &cpu)
+        : cpu(cpu), context{}, codeCache(nullptr), codeWritable(nullptr), codeEnd(nullptr), codeStart(nullptr), codePointer(nullptr), entry(nullptr), epilogue(nullptr), flushPending(false), busGeneration(cpu.bus->getGeneration()), ram{0, 0, nullptr, nullptr}
+    {
+        context.registers = cpu.r.data();
+        context.sp = &cpu.sp;
+        context.fr = &cpu.fr;
+        context.jit = this;
+
+        if (!isSupported())
+        {
+            return;
+        }
+
+        // Two views of the same memory, so no page is ever writable and executable at once: generated
+        // code runs from the executable one and is written and patched through the writable one
+        int fd = memfd_create("sx64-jit", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, SX64_JIT_CODE_CACHE_SIZE) != 0)
+        {
+            spdlog::error("Failed to allocate JIT code cache: {}", std::strerror(errno));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return;
+        }
+
+        void *executable = mmap(nullptr, SX64_JIT_CODE_CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        void *writable = mmap(nullptr, SX64_JIT_CODE_CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (executable == MAP_FAILED || writable == MAP_FAILED)
+        {
+            spdlog::error("Failed to map JIT code cache: {}", std::strerror(errno));
+            if (executable != MAP_FAILED)
+            {
+                munmap(executable, SX64_JIT_CODE_CACHE_SIZE);
+            }
+            if (writable != MAP_FAILED)
+            {
+                munmap(writable, SX64_JIT_CODE_CACHE_SIZE);
+            }
+            return;
+        }
+
+        codeCache = static_cast<uint8_t *>(executable);
+        codeWritable = static_cast<uint8_t *>(writable);
+        codeEnd = codeCache + SX64_JIT_CODE_CACHE_SIZE;
+        emitTrampoline();
+        selectRamRegion();
+
+        spdlog::debug("JIT code cache allocated: {} bytes", SX64_JIT_CODE_CACHE_SIZE);
+    }
+
+    Jit::~Jit()
+    {
+        if (codeCache)
+        {
+            munmap(codeCache, SX64_JIT_CODE_CACHE_SIZE);
+            munmap(codeWritable, SX64_JIT_CODE_CACHE_SIZE);
+        }
+    }
+
+    bool Jit::isSupported()
+    {
+#if defined(__x86_64__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool Jit::isAvailable() const
+    {
+        return codeCache != nullptr;
+    }
+
+    void Jit::emitTrampoline()
+    {
+#if defined(__x86_64__)
+        Emitter emitter(codeCache, codeWritable - codeCache);
+
+        // void entry(JitContext *context, const uint8_t *code)
+        entry = reinterpret_cast<Entry>(emitter.position());
+        emitter.push(RBP);
+        emitter.push(RBX);
+        emitter.push(R12);
+        emitter.push(R13);
+        emitter.push(R14); // Five pushes after the return address keep calls from translated code 16-byte aligned
+        emitter.movRegister(RBX, RDI);
+        emitter.movLoad(R12, RBX, offsetof(JitContext, registers));
+        emitter.movLoad(R13, RBX, offsetof(JitContext, budget));
+        emitter.movLoad(R14, RBX, offsetof(JitContext, fr));
+        emitter.jmpRegister(RSI);
+
+        // Every exit lands here with the next guest address in RAX
+        epilogue = emitter.position();
+        emitter.movStore(RBX, offsetof(JitContext, exitAddress), RAX);
+        emitter.movStore(RBX, offsetof(JitContext, budget), R13);
+        emitter.pop(R14);
+        emitter.pop(R13);
+        emitter.pop(R12);
+        emitter.pop(RBX);
+        emitter.pop(RBP);
+        emitter.ret();
+
+        codeStart = emitter.position();
+        codePointer = codeStart;
+#endif
+    }
+
+    void Jit::selectRamRegion()
+    {
+        ram = RamRegion{0, 0, nullptr, nullptr};
+
+        for (const auto &device : cpu.bus->getDevices())
+        {
+            if (!device->isEnabled() || device->isReadOnly() || device->getSize() <= ram.size)
+            {
+                continue;
+            }
+
+            // Asked for read access, translated stores mark the pages they write themselves
+            uint8_t *host = device->getHostPointer(0, false);
+            if (host)
+            {
+                ram = RamRegion{device->getBaseAddress(), device->getSize(), host, device->getDirtyBitmap()};
+            }
+        }
+
+        ramCodePages.assign((ram.size + SX64_PAGE_SIZE - 1) >> SX64_PAGE_SHIFT, 0);
+        spdlog::debug("JIT direct RAM region: {:#016x} ({} bytes)", ram.baseAddress, ram.size);
+    }
+
+    uint8_t *Jit::hostPointer(uint64_t address) const
+    {
+        uint8_t *page = cpu.bus->translate(address, false);
+        return page ? page + (address & (SX64_PAGE_SIZE - 1)) : nullptr;
+    }
+
+    bool Jit::canTranslate(const DecodedInstruction &instruction) const
+    {
+        switch (instruction.opcode)
+        {
+        case InstructionType::NOP:
+        case InstructionType::HLT:
+        case InstructionType::JMP:
+        case InstructionType::JE:
+        case InstructionType::JNE:
+            return true;
+
+        case InstructionType::WRITE:
+        case InstructionType::READ:
+        case InstructionType::LDI:
+        case InstructionType::PUSH:
+        case InstructionType::POP:
+            return instruction.reg1 < cpu.r.size();
+
+        case InstructionType::ADD:
+        case InstructionType::SUB:
+        case InstructionType::MUL:
+        case InstructionType::DIV:
+        case InstructionType::CMP:
+        case InstructionType::LD8:
+        case InstructionType::LD16:
+        case InstructionType::LD32:
+        case InstructionType::LD64:
+        case InstructionType::ST8:
+        case InstructionType::ST16:
+        case InstructionType::ST32:
+        case InstructionType::ST64:
+            return instruction.reg1 < cpu.r.size() && instruction.reg2 < cpu.r.size();
+
+        default:
+            return false;
+        }
+    }
+
+    uint64_t Jit::run(uint64_t budget)
+    {
+        context.budget = static_cast<int64_t>(budget);
+
+        while (cpu.running && context.budget > 0)
+        {
+            if (cpu.bus->getGeneration() != busGeneration)
+            {
+                // Devices moved or changed state, direct RAM pointers may be stale
+                busGeneration = cpu.bus->getGeneration();
+                selectRamRegion();
+                flushPending = true;
+            }
+
+            if (flushPending)
+            {
+                flush();
+            }
+
+            const JitBlock *block = nullptr;
+            auto it = blocks.find(cpu.ip);
+            if (it != blocks.end())
+            {
+                block = it->second.get();
+            }
+            else
+            {
+                block = translate(cpu.ip);
+            }
+
+            if (!block)
+            {
+                // Nothing translatable at this address, let the interpreter take one step
+                context.budget -= static_cast<int64_t>(cpu.interpretInstruction());
+                continue;
+            }
+
+            if (block->cycles > context.budget)
+            {
+                // The budget runs out inside this block, at the next scheduler deadline. The interpreter
+                // takes the rest one instruction at a time, so the event fires after the same instruction
+                // as on the other engines and no blocks get translated from the middle of this one.
+                while (cpu.running && context.budget > 0)
+                {
+                    context.budget -= static_cast<int64_t>(cpu.interpretInstruction());
+                }
+                break;
+            }
+
+            entry(&context, block->code);
+            cpu.ip = context.exitAddress;
+        }
+
+        if (flushPending)
+        {
+            flush();
+        }
+
+        return budget - static_cast<uint64_t>(context.budget);
+    }
+
+    const JitBlock *Jit::translate(uint64_t address)
+    {
+#if defined(__x86_64__)
+        if (static_cast<size_t>(codeEnd - codePointer) < SX64_JIT_MAX_BLOCK_CODE)
+        {
+            spdlog::debug("JIT code cache full, flushing");
+            flush();
+        }
+
+        auto block = std::make_unique<JitBlock>();
+        block->startAddress = address;
+        block->endAddress = address;
+
+        DecodedInstruction instruction;
+        while (block->instructions.size() < SX64_MAX_BLOCK_INSTRUCTIONS && decodeInstruction(*cpu.bus, block->endAddress, instruction) && canTranslate(instruction))
+        {
+            block->instructions.push_back(instruction);
+            block->endAddress += instruction.length;
+
+            if (isBlockTerminator(instruction.opcode))
+            {
+                break;
+            }
+        }
+
+        if (block->instructions.empty())
+        {
+            return nullptr;
+        }
+
+        Emitter emitter(codePointer, codeWritable - codeCache);
+        block->code = emitter.position();
+
+        const int32_t count = static_cast<int32_t>(block->instructions.size());
+
+        // Cycles still owed after each instruction, refunded when leaving the block early
+        std::vector<int32_t> remainingCycles(count + 1, 0);
+        for (int32_t i = count - 1; i >= 0; --i)
+        {
+            remainingCycles[i] = remainingCycles[i + 1] + block->instructions[i].cycles;
+        }
+        block->cycles = remainingCycles[0];
+
+        auto exitTo = [&](int32_t remaining, uint64_t target)
+        {
+            if (remaining > 0)
+            {
+                emitter.group1Immediate(GROUP1_ADD, R13, remaining);
+            }
+            emitter.movImmediate(RAX, target);
+            emitter.jmpTo(epilogue);
+        };
+
+        // Jump straight into the target block when it exists, otherwise leave a patchable exit
+        auto chainTo = [&](uint64_t target)
+        {
+            auto it = blocks.find(target);
+            if (it != blocks.end())
+            {
+                emitter.jmpTo(it->second->code);
+                return;
+            }
+
+            pendingLinks[target].push_back(emitter.jmp32());
+            exitTo(0, target);
+        };
+
+        // The block is retired up front, one add per opcode it uses. The add needs no lock, this
+        // thread is the only writer and x86-64 reads and writes it whole.
+        static_assert(SX64_MAX_BLOCK_INSTRUCTIONS <= INT8_MAX, "per-opcode counts are added as 8-bit immediates");
+        auto retire = [&](int32_t from, Group1 operation)
+        {
+            std::array<int8_t, 256> opcodeCounts{};
+            for (int32_t i = from; i < count; ++i)
+            {
+                ++opcodeCounts[block->instructions[i].opcode];
+            }
+            if (from == count)
+            {
+                return;
+            }
+            emitter.movImmediate(RAX, reinterpret_cast<uint64_t>(cpu.counters.retired.data()));
+            for (size_t opcode = 0; opcode < opcodeCounts.size(); ++opcode)
+            {
+                if (opcodeCounts[opcode])
+                {
+                    emitter.group1MemoryImmediate8(operation, RAX, static_cast<int32_t>(opcode * sizeof(CoreCounters::Counter)), opcodeCounts[opcode]);
+                }
+            }
+        };
+
+        // Run instruction index through the interpreter, leaving if it halted or invalidated code.
+        // The exit takes back the counts of the instructions after it, which never run.
+        auto interpret = [&](int32_t index)
+        {
+            const DecodedInstruction &slow = block->instructions[index];
+            emitter.movRegister(RDI, RBX);
+            emitter.movImmediate(RSI, reinterpret_cast<uint64_t>(&slow));
+            emitter.movImmediate(RAX, reinterpret_cast<uint64_t>(&Jit::interpretHelper));
+            emitter.callRegister(RAX);
+            emitter.testByteRegister(RAX);
+            uint8_t *stay = emitter.jcc32(CC_E);
+            retire(index + 1, GROUP1_SUB);
+            exitTo(remainingCycles[index + 1], slow.address + slow.length);
+            emitter.bind(stay);
+        };
+
+        // Update ZERO and NEGATIVE from the result in RAX, as the interpreter does
+        // Right after the instruction that computed RAX. CARRY and OVERFLOW come from its host flags,
+        // which ADD, SUB and IMUL set the way the interpreter defines them, DIV clears them.
+        auto updateFlags = [&](bool carry)
+        {
+            if (carry)
+            {
+                emitter.setCondition(CC_B, RCX);
+                emitter.setCondition(CC_O, RDX);
+                emitter.shiftLeftByteOnce(RDX);
+                emitter.orByteRegister(RCX, RDX);
+                emitter.shiftLeftByteOnce(RCX);
+                emitter.shiftLeftByteOnce(RCX);
+            }
+            else
+            {
+                emitter.movImmediate(RCX, 0);
+            }
+            emitter.testRegister(RAX);
+            emitter.setCondition(CC_E, RDX);
+            emitter.orByteRegister(RCX, RDX);
+            emitter.testRegister(RAX);
+            emitter.setCondition(CC_S, RDX);
+            emitter.shiftLeftByteOnce(RDX);
+            emitter.orByteRegister(RCX, RDX);
+            emitter.movzxByteRegister(RCX, RCX);
+            emitter.movzxWordLoad(RAX, R14, 0);
+            emitter.andEaxImmediate(static_cast<uint16_t>(~(ZERO | NEGATIVE | CARRY | OVERFLOW)));
+            emitter.orRegister32(RAX, RCX);
+            emitter.storeWord(R14, 0, RAX);
+        };
+
+        // A flag update is dead when the block overwrites all four flags again before anything can
+        // read them. JE and JNE read them, and so does whatever runs after an exit, so every
+        // instruction that may leave the block or call the interpreter keeps the last update live.
+        std::vector<bool> flagsLive(count, true);
+        bool overwritten = false;
+        for (int32_t i = count - 1; i >= 0; --i)
+        {
+            const DecodedInstruction &current = block->instructions[i];
+            switch (current.opcode)
+            {
+            case InstructionType::ADD:
+            case InstructionType::SUB:
+            case InstructionType::MUL:
+            case InstructionType::CMP:
+                flagsLive[i] = !overwritten;
+                overwritten = true;
+                break;
+
+            case InstructionType::DIV: // Leaves through the interpreter on division by zero
+                flagsLive[i] = !overwritten;
+                overwritten = false;
+                break;
+
+            case InstructionType::NOP:
+            case InstructionType::LDI:
+                break;
+
+            case InstructionType::READ:
+                overwritten = overwritten && hostPointer(current.operand);
+                break;
+
+            default:
+                overwritten = false;
+                break;
+            }
+        }
+
+        // Out of budget: return to the dispatcher before executing anything
+        emitter.group1Immediate(GROUP1_CMP, R13, remainingCycles[0]);
+        uint8_t *enter = emitter.jcc8(CC_GE);
+        exitTo(0, address);
+        emitter.bind8(enter);
+        emitter.group1Immediate(GROUP1_SUB, R13, remainingCycles[0]);
+
+        retire(0, GROUP1_ADD);
+
+        bool chained = false;
+        for (int32_t i = 0; i < count; ++i)
+        {
+            const DecodedInstruction &current = block->instructions[i];
+            const uint64_t next = current.address + current.length;
+
+            switch (current.opcode)
+            {
+            case InstructionType::NOP:
+                break;
+
+            // LD and ST address memory through a register, the interpreter resolves it against the bus
+            case InstructionType::HLT:
+            case InstructionType::LD8:
+            case InstructionType::LD16:
+            case InstructionType::LD32:
+            case InstructionType::LD64:
+            case InstructionType::ST8:
+            case InstructionType::ST16:
+            case InstructionType::ST32:
+            case InstructionType::ST64:
+                interpret(i);
+                break;
+
+            case InstructionType::LDI:
+                emitter.movImmediate(RAX, current.operand);
+                emitter.movStore(R12, registerSlot(current.reg1), RAX);
+                break;
+
+            case InstructionType::ADD:
+            case InstructionType::SUB:
+            case InstructionType::MUL:
+            case InstructionType::CMP:
+                emitter.movLoad(RAX, R12, registerSlot(current.reg1));
+                if (current.opcode == InstructionType::ADD)
+                {
+                    emitter.arithmeticLoad(0x03, RAX, R12, registerSlot(current.reg2));
+                }
+                else if (current.opcode == InstructionType::MUL)
+                {
+                    emitter.imulLoad(RAX, R12, registerSlot(current.reg2));
+                }
+                else
+                {
+                    emitter.arithmeticLoad(0x2B, RAX, R12, registerSlot(current.reg2));
+                }
+
+                // mov leaves the host flags alone
+                if (current.opcode != InstructionType::CMP)
+                {
+                    emitter.movStore(R12, registerSlot(current.reg1), RAX);
+                }
+                if (flagsLive[i])
+                {
+                    updateFlags(true);
+                }
+                break;
+
+            case InstructionType::DIV:
+            {
+                emitter.group1MemoryImmediate8(GROUP1_CMP, R12, registerSlot(current.reg2), 0);
+                uint8_t *byZero = emitter.jcc32(CC_E);
+                emitter.movLoad(RAX, R12, registerSlot(current.reg1));
+                emitter.xorEdxEdx();
+                emitter.divMemory(R12, registerSlot(current.reg2));
+                emitter.movStore(R12, registerSlot(current.reg1), RAX);
+                if (flagsLive[i])
+                {
+                    updateFlags(false);
+                }
+                uint8_t *done = emitter.jmp32();
+                emitter.bind(byZero);
+                interpret(i);
+                emitter.bind(done);
+                break;
+            }
+
+            case InstructionType::READ:
+            {
+                uint8_t *host = hostPointer(current.operand);
+                if (host)
+                {
+                    emitter.movImmediate(RAX, reinterpret_cast<uint64_t>(host));
+                    emitter.movzxByteLoad(RAX, RAX, 0);
+                    emitter.movStore(R12, registerSlot(current.reg1), RAX);
+                }
+                else
+                {
+                    interpret(i);
+                }
+                break;
+            }
+
+            case InstructionType::WRITE:
+            {
+                uint64_t offset = current.operand - ram.baseAddress;
+                if (ram.host && current.operand >= ram.baseAddress && offset < ram.size)
+                {
+                    emitter.movImmediate(RAX, reinterpret_cast<uint64_t>(&ramCodePages[offset >> SX64_PAGE_SHIFT]));
+                    emitter.cmpByteMemoryImmediate(RAX, 0, 0);
+                    uint8_t *slow = emitter.jcc32(CC_NE);
+                    emitter.movImmediate(RAX, reinterpret_cast<uint64_t>(ram.host + offset));
+                    emitter.movLoad(RCX, R12, registerSlot(current.reg1));
+                    emitter.storeByte(RAX, 0, RCX);
+                    if (ram.dirty)
+                    {
+                        uint64_t page = offset >> SX64_PAGE_SHIFT;
+                        uint8_t bit = static_cast<uint8_t>(1 << (page % 8));
+                        // Like MemoryDevice::markDirty, the locked OR only runs for the first write to the page
+                        emitter.movImmediate(RAX, reinterpret_cast<uint64_t>(reinterpret_cast<uint8_t *>(ram.dirty) + page / 8));
+                        emitter.testByteMemoryImmediate(RAX, 0, bit);
+                        uint8_t *marked = emitter.jcc8(CC_NE);
+                        emitter.lockOrByteMemoryImmediate(RAX, 0, bit);
+                        emitter.bind8(marked);
+                    }
+                    uint8_t *done = emitter.jmp32();
+                    emitter.bind(slow);
+                    interpret(i);
+                    emitter.bind(done);
+                }
+                else
+                {
+                    interpret(i);
+                }
+                break;
+            }
+
+            case InstructionType::PUSH:
+            {
+                if (!ram.host)
+                {
+                    interpret(i);
+                    break;
+                }
+
+                emitter.movLoad(RCX, RBX, offsetof(JitContext, sp));
+                emitter.movLoad(RAX, RCX, 0);
+                emitter.group1Immediate(GROUP1_SUB, RAX, 8);
+                emitter.movRegister(RDX, RAX);
+                emitter.movImmediate(RSI, ram.baseAddress);
+                emitter.subRegister(RDX, RSI);
+                emitter.movImmediate(RSI, ram.size);
+                emitter.cmpRegister(RDX, RSI);
+                uint8_t *outside = emitter.jcc32(CC_AE);
+                emitter.movRegister(RSI, RDX);
+                emitter.shiftRightImmediate(RSI, SX64_PAGE_SHIFT);
+                emitter.movImmediate(RDI, reinterpret_cast<uint64_t>(ramCodePages.data()));
+                emitter.cmpByteIndexedImmediate(RDI, RSI, 0);
+                uint8_t *code = emitter.jcc32(CC_NE);
+                if (ram.dirty)
+                {
+                    emitter.movImmediate(RDI, reinterpret_cast<uint64_t>(ram.dirty));
+                    emitter.btMemoryRegister(RDI, RSI);
+                    uint8_t *marked = emitter.jcc8(CC_B);
+                    emitter.lockBtsMemoryRegister(RDI, RSI);
+                    emitter.bind8(marked);
+                }
+                emitter.movStore(RCX, 0, RAX);
+                emitter.movImmediate(RDI, reinterpret_cast<uint64_t>(ram.host));
+                emitter.movLoad(RAX, R12, registerSlot(current.reg1));
+                emitter.storeByteIndexed(RDI, RDX, RAX);
+                uint8_t *done = emitter.jmp32();
+                emitter.bind(outside);
+                emitter.bind(code);
+                interpret(i);
+                emitter.bind(done);
+                break;
+            }
+
+            case InstructionType::POP:
+            {
+                if (!ram.host)
+                {
+                    interpret(i);
+                    break;
+                }
+
+                emitter.movLoad(RCX, RBX, offsetof(JitContext, sp));
+                emitter.movLoad(RDX, RCX, 0);
+                emitter.movImmediate(RSI, ram.baseAddress);
+                emitter.subRegister(RDX, RSI);
+                emitter.movImmediate(RSI, ram.size);
+                emitter.cmpRegister(RDX, RSI);
+                uint8_t *outside = emitter.jcc32(CC_AE);
+                emitter.movImmediate(RDI, reinterpret_cast<uint64_t>(ram.host));
+                emitter.movzxByteIndexed(RAX, RDI, RDX);
+                emitter.movStore(R12, registerSlot(current.reg1), RAX);
+                emitter.group1MemoryImmediate8(GROUP1_ADD, RCX, 0, 8);
+                uint8_t *done = emitter.jmp32();
+                emitter.bind(outside);
+                interpret(i);
+                emitter.bind(done);
+                break;
+            }
+
+            case InstructionType::JMP:
+                chainTo(current.operand);
+                chained = true;
+                break;
+
+            case InstructionType::JE:
+            case InstructionType::JNE:
+            {
+                emitter.testByteMemoryImmediate(R14, 0, ZERO);
+                uint8_t *notTaken = emitter.jcc32(current.opcode == InstructionType::JE ? CC_E : CC_NE);
+                chainTo(current.operand);
+                emitter.bind(notTaken);
+                chainTo(next);
+                chained = true;
+                break;
+            }
+            }
+        }
+
+        if (!chained)
+        {
+            chainTo(block->endAddress);
+        }
+
+        codePointer = emitter.position();
+
+        for (uint64_t page = block->startAddress >> SX64_PAGE_SHIFT; page <= (block->endAddress - 1) >> SX64_PAGE_SHIFT; ++page)
+        {
+            pageBlocks[page].push_back(address);
+        }
+
+        if (ram.host && block->startAddress < ram.baseAddress + ram.size && block->endAddress > ram.baseAddress)
+        {
+            uint64_t first = std::max(block->startAddress, ram.baseAddress) - ram.baseAddress;
+            uint64_t last = std::min(block->endAddress, ram.baseAddress + ram.size) - 1 - ram.baseAddress;
+            for (uint64_t page = first >> SX64_PAGE_SHIFT; page <= last >> SX64_PAGE_SHIFT; ++page)
+            {
+                ramCodePages[page] = 1;
+            }
+        }
+
+        auto links = pendingLinks.find(address);
+        if (links != pendingLinks.end())
+        {
+            for (uint8_t *site : links->second)
+            {
+                Emitter::patch(site, block->code, codeWritable - codeCache);
+            }
+            pendingLinks.erase(links);
+        }
+
+        SPDLOG_TRACE("JIT translated block {:#016x} -> {:#016x} ({} instructions, {} bytes)", block->startAddress, block->endAddress, count, codePointer - block->code);
+
+        const JitBlock *result = block.get();
+        blocks[address] = std::move(block);
+        return result;
+#else
+        (void)address;
+        return nullptr;
+#endif
+    }
+
+    void Jit::invalidate(uint64_t address, uint64_t size)
+    {
+        for (uint64_t page = address >> SX64_PAGE_SHIFT; page <= (address + size - 1) >> SX64_PAGE_SHIFT; ++page)
+        {
+            auto pageIt = pageBlocks.find(page);
+            if (pageIt == pageBlocks.end())
+            {
+                continue;
+            }
+
+            for (uint64_t startAddress : pageIt->second)
+            {
+                const JitBlock &block = *blocks.at(startAddress);
+                if (address < block.endAddress && address + size > block.startAddress)
+                {
+                    // Translated code may be on the host stack right now, drop it once we are back in run()
+                    SPDLOG_TRACE("Write to {:#016x} hit translated block {:#016x}", address, startAddress);
+                    flushPending = true;
+                    return;
+                }
+            }
+        }
+    }
+
+    void Jit::flush()
+    {
+        blocks.clear();
+        pageBlocks.clear();
+        pendingLinks.clear();
+        std::fill(ramCodePages.begin(), ramCodePages.end(), 0);
+        codePointer = codeStart;
+        flushPending = false;
+    }
+
+    bool Jit::interpretHelper(JitContext *context, const DecodedInstruction *instruction)
+    {
+        CPU &cpu = context->jit->cpu;
+        cpu.ip = instruction->address + instruction->length;
+        cpu.execute(*instruction);
+        cpu.materializeFlags();
+        return !cpu.running || context->jit->flushPending;
+    }
+}
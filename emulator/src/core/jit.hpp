@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <core/decoder.hpp>
+
+#define SX64_JIT_CODE_CACHE_SIZE (32ULL * 1024 * 1024)
+#define SX64_JIT_MAX_BLOCK_CODE (32ULL * 1024)
+
+namespace sx64
+{
+    class CPU;
+    class Jit;
+
+    // Shared with generated code, keep standard layout
+    struct JitContext
+    {
+        uint64_t *registers;
+        uint64_t *sp;
+        uint16_t *fr;
+        int64_t budget;       // Cycles left before returning to the dispatcher
+        uint64_t exitAddress; // Guest address to continue at after leaving translated code
+        Jit *jit;
+    };
+
+    struct JitBlock
+    {
+        uint64_t startAddress;
+        uint64_t endAddress; // Exclusive
+        const uint8_t *code;
+        int64_t cycles; // Of the whole block, it is only entered with at least that much budget left
+        std::vector<DecodedInstruction> instructions; // Never resized once translated, slow paths point into it
+    };
+
+    class Jit
+    {
+    public:
+        explicit Jit(CPU &cpu);
+        ~Jit();
+
+        static bool isSupported();
+        bool isAvailable() const;
+
+        uint64_t run(uint64_t budget);
+        void invalidate(uint64_t address, uint64_t size = 1);
+        void flush();
+
+    private:
+        using Entry = void (*)(JitContext *context, const uint8_t *code);
+
+        struct RamRegion
+        {
+            uint64_t baseAddress;
+            uint64_t size;
+            uint8_t *host;
+            uint64_t *dirty; // Device's written-page bitmap, set by translated stores
+        };
+
+        CPU &cpu;
+        JitContext context;
+        uint8_t *codeCache;    // Executable view
+        uint8_t *codeWritable; // Writable view of the same pages
+        uint8_t *codeEnd;
+        uint8_t *codeStart; // First byte after the trampoline
+        uint8_t *codePointer;
+        Entry entry;
+        const uint8_t *epilogue;
+        bool flushPending;
+        uint64_t busGeneration; // Bus layout the translated code was built against
+
+        RamRegion ram;
+        std::vector<uint8_t> ramCodePages; // Non-zero when a RAM page holds translated code
+
+        std::unordered_map<uint64_t, std::unique_ptr<JitBlock>> blocks;
+        std::unordered_map<uint64_t, std::vector<uint64_t>> pageBlocks;
+        std::unordered_map<uint64_t, std::vector<uint8_t *>> pendingLinks; // Target address -> unpatched jump sites
+
+        void emitTrampoline();
+        void selectRamRegion();
+        const JitBlock *translate(uint64_t address);
+        uint8_t *hostPointer(uint64_t address) const;
+        bool canTranslate(const DecodedInstruction &instruction) const;
+
+        static bool interpretHelper(JitContext *context, const DecodedInstruction *instruction);
+    };
+}
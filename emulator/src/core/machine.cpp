@@ -0,0 +1,162 @@
+#include <core/machine.hpp>
+#include <spdlog/spdlog.h>
+
+namespace sx64
+{
+    Machine::Machine(const MachineConfig &config)
+        : config(config), bus(std::make_shared<Bus>()), serialBackend(nullptr), budgetExhausted(false)
+    {
+    }
+
+    Machine::~Machine() = default;
+
+    std::unique_ptr<Machine> Machine::create(const MachineConfig &config, std::unique_ptr<SerialBackend> serial)
+    {
+        std::unique_ptr<Machine> machine(new Machine(config));
+        if (!machine->build(std::move(serial)))
+        {
+            return nullptr;
+        }
+        return machine;
+    }
+
+    bool Machine::build(std::unique_ptr<SerialBackend> serial)
+    {
+        cpu = std::make_unique<CPU>(bus, 0);
+        cpu->setEngine(config.engine);
+        cpu->setClockFrequency(config.clockFrequency);
+
+        rom = std::make_shared<MemoryDevice>("sys-bootstrap", SX64_SYS_BOOTSTRAP_SIZE, true, SX64_ADDR_SYS_BOOTSTRAP);
+        bus->attachDevice(rom);
+        spdlog::debug("System bootstrap memory device attached: {} bytes", SX64_SYS_BOOTSTRAP_SIZE);
+
+        if (!config.bootImage.empty())
+        {
+            spdlog::trace("Loading system bootstrap image from: {}", config.bootImage);
+            if (!rom->loadImage(config.bootImage))
+            {
+                spdlog::error("Failed to load system bootstrap image: {}", config.bootImage);
+                return false;
+            }
+            spdlog::debug("System bootstrap image loaded successfully");
+        }
+
+        ram = std::make_shared<MemoryDevice>("Generic (RAM)", config.ramSize, false, rom->getBaseAddress() + rom->getSize(), config.hugePages);
+        bus->attachDevice(ram);
+        spdlog::trace("RAM memory device attached: {} bytes", config.ramSize);
+
+        if (!config.ramImage.empty())
+        {
+            spdlog::trace("Loading kernel bootstrap image into RAM from: {}", config.ramImage);
+            if (!ram->loadImage(config.ramImage))
+            {
+                spdlog::error("Failed to load kernel bootstrap image: {}", config.ramImage);
+                return false;
+            }
+            spdlog::debug("Kernel bootstrap image loaded into RAM successfully");
+        }
+
+        // The machine stops with the boot core
+        serialBackend = serial.get();
+        serialBackend->setCloseHandler([this] { requestHalt(); });
+        serialDevice = std::make_shared<SerialDevice>("sx64 Serial", std::move(serial), ram->getBaseAddress() + ram->getSize());
+        bus->attachDevice(serialDevice);
+
+        if (config.coreCount > 1)
+        {
+            mailbox = std::make_shared<MailboxDevice>("sx64 Mailbox", config.coreCount, serialDevice->getBaseAddress() + SX64_PAGE_SIZE);
+            bus->attachDevice(mailbox);
+
+            for (uint64_t id = 1; id < config.coreCount; ++id)
+            {
+                auto core = std::make_unique<CPU>(bus, id);
+                core->setEngine(config.engine);
+                core->setClockFrequency(config.clockFrequency);
+                secondaryCores.push_back(std::move(core));
+            }
+            spdlog::debug("{} secondary cores, start them through the mailbox at {:#016x}", secondaryCores.size(), mailbox->getBaseAddress());
+        }
+
+        return true;
+    }
+
+    void Machine::run()
+    {
+        std::vector<std::thread> coreThreads;
+        for (auto &core : secondaryCores)
+        {
+            coreThreads.emplace_back(runSecondaryCore, std::ref(*core), std::ref(*mailbox));
+        }
+
+        Scheduler::EventId budgetEvent = 0;
+        if (config.cycleBudget)
+        {
+            auto stop = [this](uint64_t)
+            {
+                budgetExhausted = true;
+                cpu->halt();
+            };
+            budgetEvent = cpu->getScheduler().schedule(cpu->getCycles() + config.cycleBudget, stop);
+        }
+
+        spdlog::debug("Running CPU simulation...");
+        cpu->run();
+        spdlog::debug("CPU simulation finished.");
+
+        if (budgetEvent)
+        {
+            cpu->getScheduler().cancel(budgetEvent);
+        }
+
+        if (mailbox)
+        {
+            mailbox->shutdown();
+            for (auto &core : secondaryCores)
+            {
+                core->requestHalt();
+            }
+            for (std::thread &thread : coreThreads)
+            {
+                thread.join();
+            }
+        }
+    }
+
+    void Machine::runSecondaryCore(CPU &core, MailboxDevice &mailbox)
+    {
+        uint64_t address;
+        uint64_t stack;
+        while (mailbox.waitForStart(core.getId(), address, stack))
+        {
+            core.start(address, stack);
+            core.run();
+            mailbox.park(core.getId());
+            spdlog::debug("Core {} halted", core.getId());
+        }
+    }
+
+    void Machine::requestHalt()
+    {
+        cpu->requestHalt();
+    }
+
+    bool Machine::isBudgetExhausted() const
+    {
+        return budgetExhausted;
+    }
+
+    CPU &Machine::getCpu()
+    {
+        return *cpu;
+    }
+
+    std::shared_ptr<Bus> Machine::getBus()
+    {
+        return bus;
+    }
+
+    SerialBackend &Machine::getSerial()
+    {
+        return *serialBackend;
+    }
+}
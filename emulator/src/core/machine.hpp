@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <core/sx64.hpp>
+#include <devices/memory.hpp>
+#include <devices/serial.hpp>
+#include <devices/mailbox.hpp>
+
+#define SX64_SYS_BOOTSTRAP_SIZE 0x1000
+#define SX64_DEFAULT_RAM_SIZE (32ULL * 1024 * 1024)
+
+namespace sx64
+{
+    struct MachineConfig
+    {
+        std::string bootImage; // ROM contents, all zeros (NOPs into RAM) when empty
+        std::string ramImage;  // Loaded at the start of RAM, zeros when empty
+        uint64_t ramSize = SX64_DEFAULT_RAM_SIZE;
+        MemoryDevice::HugePages hugePages = MemoryDevice::HugePages::None;
+        Engine engine = Engine::Switch;
+        uint64_t clockFrequency = SX64_DEFAULT_CLOCK_FREQUENCY; // Hz, 0 runs unthrottled
+        uint64_t coreCount = 1;
+        uint64_t cycleBudget = 0; // Boot core cycles before the machine is stopped, 0 for no limit
+    };
+
+    // One emulated computer: its cores, bus and devices. Machines share no state, so any
+    // number of them can run side by side on different threads.
+    class Machine
+    {
+    public:
+        // nullptr when an image cannot be loaded, the reason is logged
+        static std::unique_ptr<Machine> create(const MachineConfig &config, std::unique_ptr<SerialBackend> serial);
+        ~Machine();
+        Machine(const Machine &) = delete;
+        Machine &operator=(const Machine &) = delete;
+
+        // Runs until the boot core halts or the cycle budget runs out. Secondary cores run on
+        // their own threads meanwhile and are stopped with it.
+        void run();
+        void requestHalt(); // Safe from any thread
+
+        bool isBudgetExhausted() const;
+        CPU &getCpu(); // Boot core
+        std::shared_ptr<Bus> getBus();
+        SerialBackend &getSerial();
+
+    private:
+        explicit Machine(const MachineConfig &config);
+        bool build(std::unique_ptr<SerialBackend> serial);
+        static void runSecondaryCore(CPU &core, MailboxDevice &mailbox);
+
+        MachineConfig config;
+        std::shared_ptr<Bus> bus;
+        std::unique_ptr<CPU> cpu;
+        std::vector<std::unique_ptr<CPU>> secondaryCores;
+        std::shared_ptr<MemoryDevice> rom;
+        std::shared_ptr<MemoryDevice> ram;
+        std::shared_ptr<SerialDevice> serialDevice;
+        std::shared_ptr<MailboxDevice> mailbox;
+        SerialBackend *serialBackend; // Owned by serialDevice
+        bool budgetExhausted;
+    };
+}
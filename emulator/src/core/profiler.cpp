@@ -0,0 +1,284 @@
+#include <core/profiler.hpp>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace sx64
+{
+    bool SymbolMap::load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            spdlog::error("Could not open symbol map \"{}\": {}", path, std::strerror(errno));
+            return false;
+        }
+
+        std::vector<std::pair<uint64_t, std::string>> symbols;
+        for (size_t i = 0; i < starts.size(); ++i)
+        {
+            symbols.emplace_back(starts[i], names[i]);
+        }
+
+        std::string line;
+        size_t lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            ++lineNumber;
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            std::istringstream fields(line);
+            std::string address;
+            std::string name;
+            if (!(fields >> address >> name))
+            {
+                spdlog::error("{}:{}: expected \"<address> <name>\"", path, lineNumber);
+                return false;
+            }
+
+            try
+            {
+                symbols.emplace_back(std::stoull(address, nullptr, 16), name);
+            }
+            catch (const std::exception &)
+            {
+                spdlog::error("{}:{}: invalid address \"{}\"", path, lineNumber, address);
+                return false;
+            }
+        }
+
+        // The first name given for an address wins
+        std::stable_sort(symbols.begin(), symbols.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        starts.clear();
+        names.clear();
+        for (auto &[start, name] : symbols)
+        {
+            if (starts.empty() || starts.back() != start)
+            {
+                starts.push_back(start);
+                names.push_back(std::move(name));
+            }
+        }
+
+        spdlog::debug("Loaded symbol map \"{}\", {} symbols in total", path, starts.size());
+        return true;
+    }
+
+    bool SymbolMap::empty() const
+    {
+        return starts.empty();
+    }
+
+    uint64_t SymbolMap::functionOf(uint64_t address) const
+    {
+        auto it = std::upper_bound(starts.begin(), starts.end(), address);
+        return it == starts.begin() ? address : *(it - 1);
+    }
+
+    uint64_t SymbolMap::endOf(uint64_t function) const
+    {
+        if (!isFunctionStart(function))
+        {
+            return function + 1;
+        }
+        auto it = std::upper_bound(starts.begin(), starts.end(), function);
+        return it == starts.end() ? ~0ULL : *it;
+    }
+
+    bool SymbolMap::isFunctionStart(uint64_t address) const
+    {
+        return std::binary_search(starts.begin(), starts.end(), address);
+    }
+
+    std::string SymbolMap::nameOf(uint64_t function) const
+    {
+        auto it = std::lower_bound(starts.begin(), starts.end(), function);
+        if (it != starts.end() && *it == function)
+        {
+            return names[it - starts.begin()];
+        }
+        return fmt::format("{:#x}", function);
+    }
+
+    Profiler::Profiler(uint64_t interval)
+        : interval(std::max<uint64_t>(interval, 1)), samples(0), topStart(0), topSize(~0ULL)
+    {
+    }
+
+    bool Profiler::loadSymbols(const std::string &path)
+    {
+        lookups.fill(CachedLookup{});
+        bool loaded = symbols.load(path);
+
+        // Nothing on the stack yet, the first jump has to go the slow way to put its function there
+        topStart = 0;
+        topSize = symbols.empty() ? ~0ULL : 0;
+        return loaded;
+    }
+
+    uint64_t Profiler::getInterval() const
+    {
+        return interval;
+    }
+
+    uint64_t Profiler::getSampleCount() const
+    {
+        return samples;
+    }
+
+    uint64_t Profiler::functionOf(uint64_t address, bool &start)
+    {
+        // Jumps go to the same few targets over and over, a binary search each time would add up
+        CachedLookup &lookup = lookups[(address ^ (address >> 8)) % SX64_PROFILE_LOOKUP_CACHE];
+        if (lookup.target != address)
+        {
+            lookup.target = address;
+            lookup.function = symbols.functionOf(address);
+            lookup.start = symbols.isFunctionStart(address);
+        }
+        start = lookup.start;
+        return lookup.function;
+    }
+
+    void Profiler::enter(uint64_t from)
+    {
+        bool start;
+        uint64_t function = functionOf(from, start);
+        if (stack.empty())
+        {
+            stack.push_back(function);
+        }
+        else
+        {
+            stack.back() = function;
+        }
+    }
+
+    void Profiler::updateTop()
+    {
+        topStart = stack.back();
+        topSize = symbols.endOf(topStart) - topStart;
+    }
+
+    void Profiler::transfer(uint64_t from, uint64_t target)
+    {
+        enter(from);
+        bool start;
+        uint64_t function = functionOf(target, start);
+        auto caller = std::find(stack.rbegin() + 1, stack.rend(), function);
+
+        // Code without symbols, like a ROM that jumps into the image it boots, is not a caller
+        bool callerKnown;
+        functionOf(stack.back(), callerKnown);
+
+        if (function == stack.back())
+        {
+            // Loops and branches of a function that was fallen into
+        }
+        else if (caller != stack.rend())
+        {
+            // Back into a caller, everything it called has returned
+            stack.erase(caller.base(), stack.end());
+        }
+        else if (start && callerKnown && stack.size() < SX64_PROFILE_MAX_DEPTH)
+        {
+            stack.push_back(function);
+        }
+        else
+        {
+            stack.back() = function;
+        }
+        updateTop();
+    }
+
+    void Profiler::call(uint64_t from, uint64_t target)
+    {
+        if (symbols.empty())
+        {
+            return;
+        }
+
+        enter(from);
+        bool start;
+        uint64_t function = functionOf(target, start);
+        if (stack.size() < SX64_PROFILE_MAX_DEPTH)
+        {
+            stack.push_back(function);
+        }
+        else
+        {
+            stack.back() = function;
+        }
+        updateTop();
+    }
+
+    void Profiler::ret(uint64_t target)
+    {
+        if (symbols.empty())
+        {
+            return;
+        }
+
+        if (stack.size() > 1)
+        {
+            stack.pop_back();
+        }
+        enter(target);
+        updateTop();
+    }
+
+    void Profiler::sample(uint64_t ip)
+    {
+        ++samples;
+
+        bool start;
+        key.clear();
+        if (!stack.empty())
+        {
+            key.assign(stack.begin(), stack.end() - 1);
+        }
+        // The leaf comes from the IP, code may have fallen through into the next function since the last jump
+        key.push_back(symbols.empty() ? ip : functionOf(ip, start));
+        ++counts[key];
+    }
+
+    bool Profiler::write(const std::string &path) const
+    {
+        std::FILE *file = std::fopen(path.c_str(), "w");
+        if (!file)
+        {
+            spdlog::error("Could not write profile \"{}\": {}", path, std::strerror(errno));
+            return false;
+        }
+
+        for (const auto &[frames, count] : counts)
+        {
+            std::string line;
+            for (uint64_t frame : frames)
+            {
+                if (!line.empty())
+                {
+                    line += ';';
+                }
+                line += symbols.nameOf(frame);
+            }
+            fmt::print(file, "{} {}\n", line, count);
+        }
+
+        if (std::fclose(file) != 0)
+        {
+            spdlog::error("Could not write profile \"{}\": {}", path, std::strerror(errno));
+            return false;
+        }
+
+        spdlog::info("Wrote {} samples in {} distinct stacks to {}", samples, counts.size(), path);
+        return true;
+    }
+}
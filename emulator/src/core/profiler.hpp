@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SX64_PROFILE_DEFAULT_INTERVAL 10007 // Cycles between samples, prime so loops do not alias with it
+#define SX64_PROFILE_MAX_DEPTH 128          // Deeper shadow stacks replace their top frame instead of growing
+#define SX64_PROFILE_LOOKUP_CACHE 256       // Direct-mapped cache of jump targets to their function
+
+namespace sx64
+{
+    // Function start addresses and names, from the .map files tools/asm.py writes next to its images
+    class SymbolMap
+    {
+    public:
+        bool load(const std::string &path); // Adds the symbols of path to the map
+        bool empty() const;
+
+        // Start of the function containing address, or address itself when no symbol covers it
+        uint64_t functionOf(uint64_t address) const;
+        uint64_t endOf(uint64_t function) const; // Start of the next function, functions have no size
+        bool isFunctionStart(uint64_t address) const;
+        std::string nameOf(uint64_t function) const; // Symbol name, or the address in hex
+
+    private:
+        std::vector<uint64_t> starts; // Sorted
+        std::vector<std::string> names;
+    };
+
+    // Samples the guest IP every few emulated cycles along with a shadow call stack, and writes them
+    // out as collapsed stacks ("caller;callee count" lines) for flamegraph.pl or speedscope.
+    //
+    // sx64 has no call instruction, so calls are inferred from jumps: a jump from a known function to the
+    // start of another calls it, a jump back into a function that is already on the stack returns to it,
+    // any other jump to another function replaces the top frame, and jumps within a function change nothing.
+    // Calls and returns of a future CALL/RET go straight to call() and ret(). Without symbols there are
+    // no functions to tell apart, and the profile is flat by IP.
+    class Profiler
+    {
+    public:
+        explicit Profiler(uint64_t interval = SX64_PROFILE_DEFAULT_INTERVAL);
+
+        bool loadSymbols(const std::string &path);
+        uint64_t getInterval() const;
+        uint64_t getSampleCount() const;
+
+        // Taken control transfers, from is the address of the instruction
+        void jump(uint64_t from, uint64_t target) // JMP, JE and JNE
+        {
+            // Most jumps are loops and branches within the function on top, and change nothing
+            if (from - topStart < topSize && target - topStart < topSize)
+            {
+                return;
+            }
+            transfer(from, target);
+        }
+        void call(uint64_t from, uint64_t target);
+        void ret(uint64_t target);
+        void sample(uint64_t ip);
+
+        bool write(const std::string &path) const;
+
+    private:
+        struct CachedLookup
+        {
+            uint64_t target = ~0ULL;
+            uint64_t function = 0;
+            bool start = false;
+        };
+
+        uint64_t functionOf(uint64_t address, bool &start);
+        void enter(uint64_t from); // Makes the function of from the top frame, it may have been fallen into
+        void transfer(uint64_t from, uint64_t target);
+        void updateTop();
+
+        SymbolMap symbols;
+        uint64_t interval;
+        uint64_t samples;
+        std::vector<uint64_t> stack; // Function start addresses, outermost first
+        uint64_t topStart;           // Address range of the top frame, everything without symbols
+        uint64_t topSize;
+        std::vector<uint64_t> key;   // Scratch for sample()
+        std::map<std::vector<uint64_t>, uint64_t> counts;
+        std::array<CachedLookup, SX64_PROFILE_LOOKUP_CACHE> lookups;
+    };
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+#define SX64_CACHE_LINE_SIZE 64
+
+namespace sx64
+{
+    // Bounded lock-free queue for exactly one producer thread and one consumer thread.
+    // Capacity must be a power of two; head and tail run freely and are masked on use.
+    template <typename T, size_t Capacity>
+    class SpscRing
+    {
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+    public:
+        bool tryPush(const T &item)
+        {
+            size_t tail = this->tail.load(std::memory_order_relaxed);
+            if (tail - cachedHead == Capacity)
+            {
+                cachedHead = head.load(std::memory_order_acquire);
+                if (tail - cachedHead == Capacity)
+                {
+                    return false;
+                }
+            }
+
+            slots[tail & (Capacity - 1)] = item;
+            this->tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Pops up to count items into out, returns how many were popped
+        size_t popBatch(T *out, size_t count)
+        {
+            size_t head = this->head.load(std::memory_order_relaxed);
+            size_t available = tail.load(std::memory_order_acquire) - head;
+            size_t popped = available < count ? available : count;
+
+            for (size_t i = 0; i < popped; ++i)
+            {
+                out[i] = slots[(head + i) & (Capacity - 1)];
+            }
+
+            this->head.store(head + popped, std::memory_order_release);
+            return popped;
+        }
+
+        bool empty() const
+        {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        // Producer and consumer indices on separate lines so they do not bounce between cores
+        alignas(SX64_CACHE_LINE_SIZE) std::atomic<size_t> head{0};
+        alignas(SX64_CACHE_LINE_SIZE) std::atomic<size_t> tail{0};
+        alignas(SX64_CACHE_LINE_SIZE) size_t cachedHead = 0; // Producer's last view of head
+        alignas(SX64_CACHE_LINE_SIZE) std::array<T, Capacity> slots;
+    };
+}
@@ -0,0 +1,66 @@
+#include <core/scheduler.hpp>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+
+namespace sx64
+{
+    Scheduler::Scheduler()
+        : nextId(1), nextDeadline(UINT64_MAX)
+    {
+    }
+
+    Scheduler::EventId Scheduler::schedule(uint64_t cycle, Callback callback)
+    {
+        EventId id = nextId++;
+        events.push_back(Event{cycle, id, std::move(callback)});
+        std::push_heap(events.begin(), events.end(), later);
+        updateDeadline();
+
+        SPDLOG_TRACE("Event {} scheduled at cycle {}", id, cycle);
+        return id;
+    }
+
+    bool Scheduler::cancel(EventId id)
+    {
+        // Only a handful of events are ever pending, a linear search beats bookkeeping
+        auto it = std::find_if(events.begin(), events.end(), [id](const Event &event) { return event.id == id; });
+        if (it == events.end())
+        {
+            return false;
+        }
+
+        events.erase(it);
+        std::make_heap(events.begin(), events.end(), later);
+        updateDeadline();
+        return true;
+    }
+
+    void Scheduler::clear()
+    {
+        events.clear();
+        updateDeadline();
+    }
+
+    void Scheduler::runDue(uint64_t now)
+    {
+        while (!events.empty() && events.front().cycle <= now)
+        {
+            std::pop_heap(events.begin(), events.end(), later);
+            Event event = std::move(events.back());
+            events.pop_back();
+            updateDeadline();
+
+            event.callback(now);
+        }
+    }
+
+    bool Scheduler::later(const Event &a, const Event &b)
+    {
+        return a.cycle != b.cycle ? a.cycle > b.cycle : a.id > b.id;
+    }
+
+    void Scheduler::updateDeadline()
+    {
+        nextDeadline = events.empty() ? UINT64_MAX : events.front().cycle;
+    }
+}
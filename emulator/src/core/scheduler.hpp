@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace sx64
+{
+    // Callbacks keyed by emulated cycle count. The CPU runs instructions up to the next
+    // deadline and then fires everything due, so devices advance with emulated time without
+    // being polled. Every engine fires an event after the first instruction that reaches its
+    // deadline: the threaded engine leaves a block there, and the JIT only enters blocks that
+    // end before it and interprets the rest.
+    class Scheduler
+    {
+    public:
+        using EventId = uint64_t; // 0 is never handed out
+        using Callback = std::function<void(uint64_t now)>;
+
+        Scheduler();
+
+        // Fires callback once the cycle count reaches cycle. Events due at the same cycle fire
+        // in the order they were scheduled. Callbacks may schedule further events.
+        EventId schedule(uint64_t cycle, Callback callback);
+        bool cancel(EventId id);
+        void clear();
+
+        // Fires every event due at now
+        void runDue(uint64_t now);
+
+        // Cycle of the earliest pending event, UINT64_MAX when there is none
+        uint64_t getNextDeadline() const
+        {
+            return nextDeadline;
+        }
+
+    private:
+        struct Event
+        {
+            uint64_t cycle;
+            EventId id;
+            Callback callback;
+        };
+
+        static bool later(const Event &a, const Event &b);
+        void updateDeadline();
+
+        std::vector<Event> events; // Min-heap on cycle, then id
+        EventId nextId;
+        uint64_t nextDeadline;
+    };
+}
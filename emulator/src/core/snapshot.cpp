@@ -0,0 +1,219 @@
+#include <core/snapshot.hpp>
+#include <spdlog/spdlog.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+namespace sx64
+{
+    static uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + SX64_SNAPSHOT_ALIGNMENT - 1) & ~static_cast<uint64_t>(SX64_SNAPSHOT_ALIGNMENT - 1);
+    }
+
+    SnapshotWriter::SnapshotWriter()
+        : fd(-1), offset(0)
+    {
+    }
+
+    SnapshotWriter::~SnapshotWriter()
+    {
+        if (fd >= 0)
+        {
+            // Never committed, leave the previous snapshot in place
+            ::close(fd);
+            unlink(temporaryPath.c_str());
+        }
+    }
+
+    bool SnapshotWriter::open(const std::string &path)
+    {
+        this->path = path;
+        temporaryPath = path + ".tmp";
+        offset = 0;
+
+        fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            spdlog::error("Could not create snapshot \"{}\": {}", temporaryPath, std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool SnapshotWriter::commit()
+    {
+        // Trailing holes only exist once the file is extended over them
+        if (ftruncate(fd, static_cast<off_t>(offset)) != 0)
+        {
+            spdlog::error("Could not write snapshot \"{}\": {}", temporaryPath, std::strerror(errno));
+            return false;
+        }
+
+        ::close(fd);
+        fd = -1;
+
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+        {
+            spdlog::error("Could not replace snapshot \"{}\": {}", path, std::strerror(errno));
+            unlink(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool SnapshotWriter::write(const void *data, uint64_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        while (size > 0)
+        {
+            ssize_t result = pwrite(fd, bytes, size, static_cast<off_t>(offset));
+            if (result < 0)
+            {
+                spdlog::error("Could not write snapshot \"{}\": {}", temporaryPath, std::strerror(errno));
+                return false;
+            }
+            bytes += result;
+            size -= static_cast<uint64_t>(result);
+            offset += static_cast<uint64_t>(result);
+        }
+        return true;
+    }
+
+    bool SnapshotWriter::writeString(const std::string &value)
+    {
+        return write(static_cast<uint64_t>(value.size())) && write(value.data(), value.size());
+    }
+
+    bool SnapshotWriter::skip(uint64_t size)
+    {
+        offset += size;
+        return true;
+    }
+
+    bool SnapshotWriter::align()
+    {
+        return skip(alignUp(offset) - offset);
+    }
+
+    uint64_t SnapshotWriter::getOffset() const
+    {
+        return offset;
+    }
+
+    SnapshotReader::SnapshotReader()
+        : fd(-1), offset(0), fileSize(0)
+    {
+    }
+
+    SnapshotReader::~SnapshotReader()
+    {
+        close();
+    }
+
+    bool SnapshotReader::open(const std::string &path)
+    {
+        this->path = path;
+        offset = 0;
+
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            spdlog::error("Could not open snapshot \"{}\": {}", path, std::strerror(errno));
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            spdlog::error("Could not stat snapshot \"{}\": {}", path, std::strerror(errno));
+            close();
+            return false;
+        }
+
+        fileSize = static_cast<uint64_t>(info.st_size);
+        return true;
+    }
+
+    void SnapshotReader::close()
+    {
+        // Mappings made from the snapshot stay valid once the descriptor is gone
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool SnapshotReader::read(void *data, uint64_t size)
+    {
+        if (!skip(size))
+        {
+            return false;
+        }
+
+        uint8_t *bytes = static_cast<uint8_t *>(data);
+        uint64_t position = offset - size;
+        while (size > 0)
+        {
+            ssize_t result = pread(fd, bytes, size, static_cast<off_t>(position));
+            if (result <= 0)
+            {
+                spdlog::error("Could not read snapshot \"{}\": {}", path, result < 0 ? std::strerror(errno) : "unexpected end of file");
+                return false;
+            }
+            bytes += result;
+            size -= static_cast<uint64_t>(result);
+            position += static_cast<uint64_t>(result);
+        }
+        return true;
+    }
+
+    bool SnapshotReader::readString(std::string &value)
+    {
+        uint64_t length;
+        if (!read(length) || length > fileSize - offset)
+        {
+            spdlog::error("Snapshot \"{}\" is truncated or corrupt", path);
+            return false;
+        }
+
+        value.resize(length);
+        return read(value.data(), length);
+    }
+
+    bool SnapshotReader::skip(uint64_t size)
+    {
+        // Sections are mapped rather than read, catch short files here instead of as SIGBUS later
+        if (size > fileSize - offset)
+        {
+            spdlog::error("Snapshot \"{}\" is truncated", path);
+            return false;
+        }
+        offset += size;
+        return true;
+    }
+
+    bool SnapshotReader::align()
+    {
+        return skip(alignUp(offset) - offset);
+    }
+
+    uint64_t SnapshotReader::getOffset() const
+    {
+        return offset;
+    }
+
+    int SnapshotReader::getFd() const
+    {
+        return fd;
+    }
+
+    const std::string &SnapshotReader::getPath() const
+    {
+        return path;
+    }
+}
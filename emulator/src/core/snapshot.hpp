@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#define SX64_SNAPSHOT_MAGIC "SX64SNP"
+#define SX64_SNAPSHOT_VERSION 2
+#define SX64_SNAPSHOT_MAX_CHAIN 4096 // Deltas restored on top of each other before giving up on a cycle
+#define SX64_SNAPSHOT_ALIGNMENT 0x10000 // Mappable sections start on a boundary every host page size divides
+
+namespace sx64
+{
+    enum class SnapshotKind : uint32_t
+    {
+        Full = 0, // Complete machine state
+        Delta = 1 // Memory written since the base snapshot, whose path follows the header
+    };
+
+    struct SnapshotFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t deviceCount;
+        SnapshotKind kind;
+        uint32_t reserved;
+    };
+
+    // Sequential writer for snapshot files. The snapshot goes to a temporary file that replaces
+    // the target on commit, so a snapshot still mapped by a restored machine is never rewritten in place.
+    class SnapshotWriter
+    {
+    public:
+        SnapshotWriter();
+        ~SnapshotWriter();
+        SnapshotWriter(const SnapshotWriter &) = delete;
+        SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+        bool open(const std::string &path);
+        bool commit();
+
+        bool write(const void *data, uint64_t size);
+        bool writeString(const std::string &value);
+        bool skip(uint64_t size); // Leaves a hole that reads back as zeros
+        bool align();
+        uint64_t getOffset() const;
+
+        template <typename T>
+        bool write(const T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be written as is");
+            return write(&value, sizeof(value));
+        }
+
+    private:
+        int fd;
+        uint64_t offset;
+        std::string path;
+        std::string temporaryPath;
+    };
+
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader();
+        ~SnapshotReader();
+        SnapshotReader(const SnapshotReader &) = delete;
+        SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+        bool open(const std::string &path);
+        void close();
+
+        bool read(void *data, uint64_t size);
+        bool readString(std::string &value);
+        bool skip(uint64_t size);
+        bool align();
+        uint64_t getOffset() const;
+        int getFd() const;
+        const std::string &getPath() const;
+
+        template <typename T>
+        bool read(T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be read as is");
+            return read(&value, sizeof(value));
+        }
+
+    private:
+        int fd;
+        uint64_t offset;
+        uint64_t fileSize;
+        std::string path;
+    };
+}
@@ -0,0 +1,253 @@
+#include <core/stats.hpp>
+#include <core/decoder.hpp>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <mutex>
+
+namespace sx64
+{
+    namespace
+    {
+        struct Registry
+        {
+            std::mutex mutex;
+            std::vector<CoreCounters *> live;
+            StatsSnapshot departed; // Counts of destroyed cores, so the totals never go backwards
+            std::vector<std::string> deviceNames{"other"};
+        };
+
+        Registry &registry()
+        {
+            static Registry instance;
+            return instance;
+        }
+
+        // Adds the counters of one core to a snapshot, the registry lock is held
+        void accumulate(StatsSnapshot &snapshot, const CoreCounters &counters)
+        {
+            CoreTotals &core = snapshot.cores[counters.coreId];
+            for (size_t opcode = 0; opcode < counters.retired.size(); ++opcode)
+            {
+                uint64_t count = CoreCounters::read(counters.retired[opcode]);
+                snapshot.retired[opcode] += count;
+                core.instructions += count;
+            }
+
+            for (size_t slot = 0; slot < SX64_STATS_MAX_DEVICES; ++slot)
+            {
+                snapshot.deviceReads[slot] += CoreCounters::read(counters.deviceReads[slot]);
+                snapshot.deviceWrites[slot] += CoreCounters::read(counters.deviceWrites[slot]);
+            }
+
+            snapshot.unmappedHalts += CoreCounters::read(counters.unmappedHalts);
+            core.cycles += CoreCounters::read(counters.cycles);
+            core.emulatedNanoseconds += CoreCounters::read(counters.emulatedNanoseconds);
+            core.hostNanoseconds += CoreCounters::read(counters.hostNanoseconds);
+        }
+
+        std::string escapeLabel(const std::string &value)
+        {
+            std::string escaped;
+            for (char c : value)
+            {
+                if (c == '\\' || c == '"')
+                {
+                    escaped += '\\';
+                    escaped += c;
+                }
+                else if (c == '\n')
+                {
+                    escaped += "\\n";
+                }
+                else
+                {
+                    escaped += c;
+                }
+            }
+            return escaped;
+        }
+
+        std::string opcodeLabel(size_t opcode)
+        {
+            const char *name = instructionName(static_cast<uint8_t>(opcode));
+            return name ? name : fmt::format("{:#04x}", opcode);
+        }
+    }
+
+    CoreCounters::CoreCounters(uint64_t coreId)
+        : coreId(coreId)
+    {
+        Stats::attach(this);
+    }
+
+    CoreCounters::~CoreCounters()
+    {
+        Stats::detach(this);
+    }
+
+    double CoreTotals::getMips() const
+    {
+        return hostNanoseconds ? instructions * 1000.0 / hostNanoseconds : 0.0;
+    }
+
+    double StatsSnapshot::getMips() const
+    {
+        double mips = 0;
+        for (const auto &[id, core] : cores)
+        {
+            mips += core.getMips();
+        }
+        return mips;
+    }
+
+    uint32_t Stats::deviceSlot(const std::string &name)
+    {
+        Registry &state = registry();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        auto it = std::find(state.deviceNames.begin(), state.deviceNames.end(), name);
+        if (it != state.deviceNames.end())
+        {
+            return static_cast<uint32_t>(it - state.deviceNames.begin());
+        }
+
+        if (state.deviceNames.size() >= SX64_STATS_MAX_DEVICES)
+        {
+            SPDLOG_DEBUG("No counter slot left for device \"{}\", counted as \"other\"", name);
+            return 0;
+        }
+
+        state.deviceNames.push_back(name);
+        return static_cast<uint32_t>(state.deviceNames.size() - 1);
+    }
+
+    void Stats::attach(CoreCounters *counters)
+    {
+        Registry &state = registry();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.live.push_back(counters);
+    }
+
+    void Stats::detach(CoreCounters *counters)
+    {
+        Registry &state = registry();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        accumulate(state.departed, *counters);
+        state.live.erase(std::remove(state.live.begin(), state.live.end(), counters), state.live.end());
+    }
+
+    StatsSnapshot Stats::collect()
+    {
+        Registry &state = registry();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        StatsSnapshot snapshot = state.departed;
+        for (const CoreCounters *counters : state.live)
+        {
+            accumulate(snapshot, *counters);
+        }
+        snapshot.deviceNames = state.deviceNames;
+        return snapshot;
+    }
+
+    std::string Stats::formatPrometheus(const StatsSnapshot &snapshot)
+    {
+        std::string out;
+        auto header = [&](const char *name, const char *type, const char *help)
+        {
+            out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+        };
+
+        header("sx64_instructions_retired_total", "counter", "Instructions retired, by opcode.");
+        for (size_t opcode = 0; opcode < snapshot.retired.size(); ++opcode)
+        {
+            if (instructionName(static_cast<uint8_t>(opcode)) || snapshot.retired[opcode])
+            {
+                out += fmt::format("sx64_instructions_retired_total{{opcode=\"{}\"}} {}\n", opcodeLabel(opcode), snapshot.retired[opcode]);
+            }
+        }
+
+        header("sx64_bus_reads_total", "counter", "Reads that went through the bus, by device. RAM served from host pointers is not included.");
+        for (size_t slot = 0; slot < snapshot.deviceNames.size(); ++slot)
+        {
+            out += fmt::format("sx64_bus_reads_total{{device=\"{}\"}} {}\n", escapeLabel(snapshot.deviceNames[slot]), snapshot.deviceReads[slot]);
+        }
+
+        header("sx64_bus_writes_total", "counter", "Writes that went through the bus, by device. RAM served from host pointers is not included.");
+        for (size_t slot = 0; slot < snapshot.deviceNames.size(); ++slot)
+        {
+            out += fmt::format("sx64_bus_writes_total{{device=\"{}\"}} {}\n", escapeLabel(snapshot.deviceNames[slot]), snapshot.deviceWrites[slot]);
+        }
+
+        header("sx64_unmapped_access_halts_total", "counter", "Cores halted by an access to unmapped memory.");
+        out += fmt::format("sx64_unmapped_access_halts_total {}\n", snapshot.unmappedHalts);
+
+        header("sx64_cycles_total", "counter", "Emulated clock cycles, by core.");
+        for (const auto &[id, core] : snapshot.cores)
+        {
+            out += fmt::format("sx64_cycles_total{{core=\"{}\"}} {}\n", id, core.cycles);
+        }
+
+        header("sx64_emulated_seconds_total", "counter", "Emulated time, by core. Unthrottled cores do not advance it.");
+        for (const auto &[id, core] : snapshot.cores)
+        {
+            out += fmt::format("sx64_emulated_seconds_total{{core=\"{}\"}} {:.9f}\n", id, core.emulatedNanoseconds / 1e9);
+        }
+
+        header("sx64_host_seconds_total", "counter", "Host time spent running, by core.");
+        for (const auto &[id, core] : snapshot.cores)
+        {
+            out += fmt::format("sx64_host_seconds_total{{core=\"{}\"}} {:.9f}\n", id, core.hostNanoseconds / 1e9);
+        }
+
+        header("sx64_mips", "gauge", "Instructions retired per host microsecond spent running, by core.");
+        for (const auto &[id, core] : snapshot.cores)
+        {
+            out += fmt::format("sx64_mips{{core=\"{}\"}} {:.3f}\n", id, core.getMips());
+        }
+
+        return out;
+    }
+
+    void Stats::dump()
+    {
+        StatsSnapshot snapshot = collect();
+
+        uint64_t instructions = 0;
+        uint64_t hostNanoseconds = 0;
+        uint64_t emulatedNanoseconds = 0;
+        for (const auto &[id, core] : snapshot.cores)
+        {
+            instructions += core.instructions;
+            hostNanoseconds = std::max(hostNanoseconds, core.hostNanoseconds);
+            emulatedNanoseconds = std::max(emulatedNanoseconds, core.emulatedNanoseconds);
+        }
+
+        spdlog::info("{} instructions retired in {:.3f} s of host time ({:.2f} MIPS), {:.3f} s emulated",
+                     instructions, hostNanoseconds / 1e9, snapshot.getMips(), emulatedNanoseconds / 1e9);
+        if (snapshot.unmappedHalts)
+        {
+            spdlog::info("Cores halted by unmapped accesses: {}", snapshot.unmappedHalts);
+        }
+
+        spdlog::debug("Performance Counters:");
+        for (const auto &[id, core] : snapshot.cores)
+        {
+            spdlog::debug("  Core {}: {} instructions, {} cycles, {:.2f} MIPS", id, core.instructions, core.cycles, core.getMips());
+        }
+        for (size_t opcode = 0; opcode < snapshot.retired.size(); ++opcode)
+        {
+            if (snapshot.retired[opcode])
+            {
+                spdlog::debug("  {:<6} {}", opcodeLabel(opcode), snapshot.retired[opcode]);
+            }
+        }
+        for (size_t slot = 0; slot < snapshot.deviceNames.size(); ++slot)
+        {
+            if (snapshot.deviceReads[slot] || snapshot.deviceWrites[slot])
+            {
+                spdlog::debug("  Device \"{}\": {} reads, {} writes", snapshot.deviceNames[slot], snapshot.deviceReads[slot], snapshot.deviceWrites[slot]);
+            }
+        }
+    }
+}
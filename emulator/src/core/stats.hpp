@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SX64_STATS_MAX_DEVICES 64       // Distinct device names counted apart, later ones share slot 0
+#define SX64_STATS_PUBLISH_CYCLES 65536 // Cycles between updates of a core's time counters
+
+namespace sx64
+{
+    // Counters of one core, and so of the host thread running it. Only that thread writes them, so
+    // an increment is a relaxed load and store rather than a locked add, and costs no more than the
+    // instruction count the CPU keeps anyway. Other threads read them with relaxed loads.
+    class CoreCounters
+    {
+    public:
+        using Counter = std::atomic<uint64_t>;
+        static_assert(Counter::is_always_lock_free && sizeof(Counter) == sizeof(uint64_t), "the JIT adds to counters as plain 64-bit memory");
+
+        explicit CoreCounters(uint64_t coreId);
+        ~CoreCounters(); // Adds the counts to those of the cores that are gone
+        CoreCounters(const CoreCounters &) = delete;
+        CoreCounters &operator=(const CoreCounters &) = delete;
+
+        static void add(Counter &counter, uint64_t amount = 1)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        static void set(Counter &counter, uint64_t value)
+        {
+            counter.store(value, std::memory_order_relaxed);
+        }
+
+        static uint64_t read(const Counter &counter)
+        {
+            return counter.load(std::memory_order_relaxed);
+        }
+
+        const uint64_t coreId;
+        std::array<Counter, 256> retired{}; // Instructions, by opcode
+        std::array<Counter, SX64_STATS_MAX_DEVICES> deviceReads{}; // Accesses through the bus, by device slot
+        std::array<Counter, SX64_STATS_MAX_DEVICES> deviceWrites{};
+        Counter unmappedHalts{0};
+        Counter cycles{0};
+        Counter emulatedNanoseconds{0}; // Cycles at the clock they ran at, unthrottled cycles take no time
+        Counter hostNanoseconds{0};     // Host time spent in CPU::run
+    };
+
+    struct CoreTotals
+    {
+        uint64_t instructions = 0;
+        uint64_t cycles = 0;
+        uint64_t emulatedNanoseconds = 0;
+        uint64_t hostNanoseconds = 0;
+
+        double getMips() const;
+    };
+
+    // Counters of every core in the process, merged. Cores with the same index in different
+    // machines are added together.
+    struct StatsSnapshot
+    {
+        std::array<uint64_t, 256> retired{};
+        std::array<uint64_t, SX64_STATS_MAX_DEVICES> deviceReads{};
+        std::array<uint64_t, SX64_STATS_MAX_DEVICES> deviceWrites{};
+        uint64_t unmappedHalts = 0;
+        std::map<uint64_t, CoreTotals> cores;
+        std::vector<std::string> deviceNames; // By slot
+
+        double getMips() const; // Sum over the cores
+    };
+
+    class Stats
+    {
+    public:
+        // Counter slot for the device called name, the same for every device of that name
+        static uint32_t deviceSlot(const std::string &name);
+
+        static StatsSnapshot collect();
+        static std::string formatPrometheus(const StatsSnapshot &snapshot);
+        static void dump(); // Logs the counters, next to CPU::dumpState at halt
+
+    private:
+        friend class CoreCounters;
+        static void attach(CoreCounters *counters);
+        static void detach(CoreCounters *counters);
+    };
+}
@@ -1,389 +1,1513 @@
-#include <global.hpp>
 #include <core/sx64.hpp>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
 #include <chrono>
 #include <thread>
 #include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <iterator>
 
 namespace sx64
 {
-    CPU::CPU()
-        : r(8, 0), sb(0), sp(0), ip(SX64_ADDR_SYS_BOOTSTRAP), fr(0), bus(std::make_shared<Bus>()), running(false), lastStepTime(std::chrono::steady_clock::now())
-    {
-        spdlog::trace("CPU initialized with IP: {:#016x}", ip);
-    }
+    static thread_local CPU *currentCore = nullptr;
 
-    void CPU::setFlag(Flag flag)
+    // Where a run starting at instruction stops: after the instruction that reaches the deadline, or at the end
+    static const DecodedInstruction *stopAfter(const DecodedInstruction *instruction, const DecodedInstruction *end, uint64_t now, uint64_t deadline)
     {
-        fr |= flag;
+        do
+        {
+            now += instruction->cycles;
+            ++instruction;
+        } while (instruction != end && now < deadline);
+        return instruction;
     }
 
-    void CPU::clearFlag(Flag flag)
+    CPU::CPU()
+        : CPU(std::make_shared<Bus>(), 0)
     {
-        fr &= ~flag;
     }
 
-    bool CPU::isFlagSet(Flag flag) const
+    CPU::CPU(std::shared_ptr<Bus> bus, uint64_t id)
+        : r{}, sb(0), sp(0), ip(SX64_ADDR_SYS_BOOTSTRAP), fr(0), flagSource(FlagSource::None), flagLeft(0), flagRight(0), flagResult(0), bus(std::move(bus)), id(id), counters(id), running(false), haltRequested(false), cycles(0), clockFrequency(SX64_DEFAULT_CLOCK_FREQUENCY), clockBaseCycles(0), clockEvent(0), statsEvent(0), statsCycles(0), statsHostBase(0), currentBlock(nullptr), blockIndex(0), busGeneration(0), engine(Engine::Switch), tracer(nullptr), traceRecord{}, profiler(nullptr), profileEvent(0)
     {
-        return (fr & flag) != 0;
+        spdlog::trace("CPU {} initialized with IP: {:#016x}", id, ip);
     }
 
-    void CPU::fetchInstructions()
+    uint16_t CPU::computeFlags() const
     {
-        spdlog::trace("Fetching instructions from IP {:#016x}", ip);
+        if (flagSource == FlagSource::None)
+        {
+            return fr;
+        }
 
-        uint8_t opcode = static_cast<uint8_t>(bus->read(ip));
-        ip += 1;
+        uint16_t flags = fr & ~(ZERO | NEGATIVE | CARRY | OVERFLOW);
+        if (flagResult == 0)
+        {
+            flags |= ZERO;
+        }
+        if (static_cast<int64_t>(flagResult) < 0)
+        {
+            flags |= NEGATIVE;
+        }
 
-        switch (opcode)
+        // CARRY is the unsigned carry or borrow, OVERFLOW the signed overflow (for MUL both mean the
+        // signed product did not fit), like the x86-64 flags the JIT takes them from
+        bool carry = false;
+        bool overflow = false;
+        switch (flagSource)
         {
-        case static_cast<uint8_t>(InstructionType::NOP):
-            spdlog::debug("NOP @ {:#016x}", ip);
+        case FlagSource::Add:
+            carry = flagResult < flagLeft;
+            overflow = (~(flagLeft ^ flagRight) & (flagLeft ^ flagResult)) >> 63;
             break;
 
-        case static_cast<uint8_t>(InstructionType::HLT):
-            spdlog::debug("HLT @ {:#016x}", ip);
-            halt();
+        case FlagSource::Sub:
+            carry = flagLeft < flagRight;
+            overflow = ((flagLeft ^ flagRight) & (flagLeft ^ flagResult)) >> 63;
             break;
 
-        case static_cast<uint8_t>(InstructionType::WRITE):
+        case FlagSource::Mul:
         {
-            uint8_t regIn = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-
-            uint64_t address = 0;
-            for (size_t i = 0; i < 8; ++i)
-            {
-                address |= static_cast<uint64_t>(bus->read(ip + i)) << (i * 8);
-            }
-            ip += 8;
-
-            uint64_t valueToWrite = getRegister(regIn);
-            spdlog::debug("WRITE @ {:#016x}, Register R{} = {:#018x}", address, regIn, valueToWrite);
-            bus->write(address, static_cast<uint8_t>(valueToWrite));
+            int64_t product;
+            carry = overflow = __builtin_mul_overflow(static_cast<int64_t>(flagLeft), static_cast<int64_t>(flagRight), &product);
+            break;
+        }
 
+        default:
             break;
         }
 
-        case static_cast<uint8_t>(InstructionType::READ):
+        if (carry)
+        {
+            flags |= CARRY;
+        }
+        if (overflow)
+        {
+            flags |= OVERFLOW;
+        }
+        return flags;
+    }
+
+    void CPU::materializeFlags()
+    {
+        fr = computeFlags();
+        flagSource = FlagSource::None;
+    }
+
+    bool CPU::isFlagSet(Flag flag) const
+    {
+        // JE and JNE only look at ZERO, which needs nothing but the result
+        if (flagSource != FlagSource::None && flag == ZERO)
         {
-            uint8_t regOut = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
+            return flagResult == 0;
+        }
+        return (computeFlags() & flag) != 0;
+    }
+
+    void CPU::fetchInstructions()
+    {
+        SPDLOG_TRACE("Fetching instructions from IP {:#016x}", ip);
 
-            uint64_t address = 0;
-            for (size_t i = 0; i < 8; ++i)
+        if (!currentBlock || blockIndex >= currentBlock->instructions.size() || currentBlock->instructions[blockIndex].address != ip)
+        {
+            currentBlock = lookupBlock(ip);
+            if (!currentBlock)
             {
-                address |= static_cast<uint64_t>(bus->read(ip + i)) << (i * 8);
+                return;
             }
-            ip += 8;
 
-            uint8_t valueRead = bus->read(address);
-            setRegister(regOut, valueRead);
-            spdlog::debug("READ @ {:#016x}, Register R{} = {:#018x}", address, regOut, valueRead);
+            blockIndex = 0;
+        }
 
-            break;
+        const DecodedInstruction &instruction = currentBlock->instructions[blockIndex++];
+        ip += instruction.length;
+        cycles += instruction.cycles;
+        CoreCounters::add(counters.retired[instruction.opcode]);
+
+        if (tracer)
+        {
+            beginTrace(instruction);
+            execute(instruction);
+            tracer->record(traceRecord);
+            return;
         }
 
-        case static_cast<uint8_t>(InstructionType::LDI):
+        execute(instruction);
+    }
+
+    const BasicBlock *CPU::lookupBlock(uint64_t address)
+    {
+        icache.releaseRetired();
+
+        syncBus();
+
+        const BasicBlock *block = icache.find(address);
+        if (!block)
         {
-            uint8_t regOut = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
+            block = icache.decode(*bus, address);
+        }
 
-            uint64_t immediateValue = 0;
-            for (size_t i = 0; i < 8; ++i)
-            {
-                immediateValue |= static_cast<uint64_t>(bus->read(ip + i)) << (i * 8);
-            }
-            ip += 8;
+        if (!block)
+        {
+            reportFetchFault(address);
+        }
 
-            setRegister(regOut, immediateValue);
-            spdlog::debug("LDI @ {:#016x}, Register R{} = {:#018x}", ip, regOut, immediateValue);
+        return block;
+    }
 
-            break;
+    void CPU::reportFetchFault(uint64_t address)
+    {
+        // The instruction runs into unmapped memory, let the bus report and halt
+        uint8_t opcode = bus->read(address);
+        for (uint8_t i = 1; i < instructionLength(opcode); ++i)
+        {
+            bus->read(address + i);
         }
+        halt();
+    }
 
-        case static_cast<uint8_t>(InstructionType::ADD):
+    uint64_t CPU::interpretInstruction()
+    {
+        // Decoded fresh rather than through the block cache, which translated code does not keep coherent
+        DecodedInstruction instruction;
+        if (!decodeInstruction(*bus, ip, instruction))
         {
-            uint8_t dest = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint8_t src = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint64_t result = r[dest] + r[src];
-            r[dest] = result;
+            reportFetchFault(ip);
+            return 0;
+        }
 
-            if (result == 0)
-            {
-                setFlag(ZERO);
-            }
-            else
+        ip += instruction.length;
+        CoreCounters::add(counters.retired[instruction.opcode]);
+        execute(instruction);
+        materializeFlags(); // Translated code reads fr directly
+        return instruction.cycles;
+    }
+
+    size_t CPU::executeBlock()
+    {
+        // A block left at a deadline is picked up where it stopped, like fetchInstructions does
+        const BasicBlock *block = currentBlock;
+        size_t i = blockIndex;
+        if (block)
+        {
+            syncBus(); // An event may have changed the bus, lookupBlock checks it otherwise
+            block = currentBlock;
+        }
+        if (block && i >= block->instructions.size())
+        {
+            if (const BasicBlock *next = linkedBlock(*block))
             {
-                clearFlag(ZERO);
+                block = next;
+                i = 0;
             }
-
-            if (static_cast<int64_t>(result) < 0)
+        }
+        if (!block || i >= block->instructions.size() || block->instructions[i].address != ip)
+        {
+            const BasicBlock *previous = block && i >= block->instructions.size() ? block : nullptr;
+            block = lookupBlock(ip);
+            if (!block)
             {
-                setFlag(NEGATIVE);
+                return 0;
             }
-            else
+            if (previous)
             {
-                clearFlag(NEGATIVE);
+                previous->successors[ip != previous->endAddress] = {block, icache.getEpoch()};
             }
+            i = 0;
+        }
 
-            spdlog::debug("ADD R{} += R{} -> {:#018x}", dest, src, r[dest]);
-            break;
+        currentBlock = block;
+        blockIndex = block->instructions.size();
+
+        if (tracer)
+        {
+            return traceBlock(*block, i);
         }
 
-        case static_cast<uint8_t>(InstructionType::SUB):
+        // Opcodes run in place, by label. The others go through the handler table. Every opcode has its entry, so
+        // dispatching needs no bounds check.
+#define SX64_GENERIC_4 &&generic, &&generic, &&generic, &&generic
+#define SX64_GENERIC_16 SX64_GENERIC_4, SX64_GENERIC_4, SX64_GENERIC_4, SX64_GENERIC_4
+        static void *const dispatch[] = {&&nop, &&generic, &&generic, &&generic, &&ldi, &&add, &&sub, &&mul,
+                                         &&generic, &&generic, &&generic, &&jmp, &&cmp, &&je, &&jne, &&generic,
+                                         SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16,
+                                         SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16,
+                                         SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16, SX64_GENERIC_16};
+        static_assert(std::size(dispatch) == 256, "Every opcode needs its entry in dispatch");
+#undef SX64_GENERIC_16
+#undef SX64_GENERIC_4
+
+        // Cycles stay in a local between handler calls, ip is only brought up to date for the handlers and on the way out
+        const DecodedInstruction *begin;
+        const DecodedInstruction *end;
+        const DecodedInstruction *first;
+        const DecodedInstruction *instruction;
+        const DecodedInstruction *stop;
+        uint64_t now = cycles;
+        uint64_t deadline = scheduler.getNextDeadline();
+        size_t executed = 0;
+
+        // The last register an ALU operation or LDI wrote, also kept in a host register so a chain of operations
+        // on it does not wait on the store to r. Only good until the next call, which may change r behind it.
+        unsigned cachedRegister;
+        uint64_t cachedValue;
+
+#define SX64_FORGET()          \
+    cachedRegister = r.size(); \
+    cachedValue = 0
+// The hints lay out a run of ALU operations on one register, flags unread, without taken branches
+#define SX64_DESTINATION() (__builtin_expect(instruction->reg1 == cachedRegister, 1) ? cachedValue : r[instruction->reg1])
+// Flags the next instruction overwrites are only read when the run stops in between
+#define SX64_FLAGS_READ() __builtin_expect(!instruction->flagsOverwritten || instruction + 1 == stop, 0)
+#define SX64_DISPATCH() goto *dispatch[instruction->opcode]
+// Events fire after the same instruction as on the switch engine, stop is worked out from the deadline up front
+#define SX64_NEXT()                 \
+    now += instruction->cycles;     \
+    if (++instruction == stop)      \
+    {                               \
+        goto sequential;            \
+    }                               \
+    SX64_DISPATCH()
+
+    enter:
+        begin = block->instructions.data();
+        end = begin + block->instructions.size();
+        first = begin + i;
+        instruction = first;
+        stop = first == begin && now + block->cycles < deadline ? end : stopAfter(instruction, end, now, deadline);
+        SX64_FORGET();
+        SX64_DISPATCH();
+
+    nop:
+        execNop(*instruction);
+        SX64_NEXT();
+
+    ldi:
+        if (instruction->fusion != Fusion::None && now + instruction->cycles < deadline)
         {
-            uint8_t dest = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint8_t src = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint64_t result = r[dest] - r[src];
-            r[dest] = result;
+            goto fusedStore;
+        }
+        execLdi(*instruction);
+        cachedRegister = instruction->reg1;
+        cachedValue = instruction->operand;
+        SX64_NEXT();
 
-            if (result == 0)
-            {
-                setFlag(ZERO);
-            }
-            else
-            {
-                clearFlag(ZERO);
-            }
+    add:
+        cachedValue = addRegisters(*instruction, SX64_DESTINATION(), SX64_FLAGS_READ());
+        cachedRegister = instruction->reg1;
+        SX64_NEXT();
 
-            if (static_cast<int64_t>(result) < 0)
-            {
-                setFlag(NEGATIVE);
-            }
-            else
-            {
-                clearFlag(NEGATIVE);
-            }
+    sub:
+        cachedValue = subRegisters(*instruction, SX64_DESTINATION(), SX64_FLAGS_READ());
+        cachedRegister = instruction->reg1;
+        SX64_NEXT();
 
-            spdlog::debug("SUB R{} -= R{} -> {:#018x}", dest, src, r[dest]);
-            break;
+    mul:
+        cachedValue = mulRegisters(*instruction, SX64_DESTINATION(), SX64_FLAGS_READ());
+        cachedRegister = instruction->reg1;
+        SX64_NEXT();
+
+    cmp:
+        if (instruction->fusion != Fusion::None && now + instruction->cycles < deadline)
+        {
+            goto fusedBranch;
         }
+        compareRegisters(*instruction, SX64_DESTINATION(), SX64_FLAGS_READ());
+        SX64_NEXT();
 
-        case static_cast<uint8_t>(InstructionType::MUL):
+    jmp:
+        execJmp(*instruction);
+        goto jumped;
+
+    je:
+        ip = instruction->address + instruction->length;
+        execJe(*instruction);
+        goto jumped;
+
+    jne:
+        ip = instruction->address + instruction->length;
+        execJne(*instruction);
+        goto jumped;
+
+    jumped:
+        // Jumps end their block
+        now += instruction->cycles;
+        ++instruction;
+        goto leave;
+
+    // Fused pairs are run one instruction at a time when a deadline falls between the two, so the event fires after the first
+    fusedStore:
+        ip = instruction[1].address + instruction[1].length;
+        cycles = now + instruction[0].cycles + instruction[1].cycles;
+        execStoreImmediate(instruction[0], instruction[1]);
+        SX64_FORGET();
+        instruction += 2;
+        goto handled;
+
+    fusedBranch:
+        // The branch ends the block
+        now += instruction[0].cycles + instruction[1].cycles;
+        ip = instruction[1].address + instruction[1].length;
+        execCompareBranch(instruction[0], instruction[1]);
+        instruction += 2;
+        goto leave;
+
+    generic:
+        ip = instruction->address + instruction->length;
+        cycles = now + instruction->cycles;
+        (this->*handlers[instruction->opcode])(*instruction);
+        SX64_FORGET();
+        ++instruction;
+
+    handled:
+        // Stop on halt, or when a write invalidated the block we are running from
+        now = cycles;
+        if (!running || currentBlock != block)
         {
-            uint8_t dest = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint8_t src = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint64_t result = r[dest] * r[src];
-            r[dest] = result;
+            goto leave;
+        }
+        if (scheduler.getNextDeadline() != deadline)
+        {
+            // The handler scheduled or cancelled an event
+            deadline = scheduler.getNextDeadline();
+            stop = instruction == end || now >= deadline ? instruction : stopAfter(instruction, end, now, deadline);
+        }
+        if (instruction == stop)
+        {
+            goto stopped; // The handler left ip where it goes on
+        }
+        SX64_DISPATCH();
+
+#undef SX64_NEXT
+#undef SX64_DISPATCH
+#undef SX64_DESTINATION
+#undef SX64_FLAGS_READ
+#undef SX64_FORGET
 
-            if (result == 0)
+    sequential:
+        ip = instruction[-1].address + instruction[-1].length;
+
+    stopped:
+        blockIndex = instruction - begin;
+
+    leave:
+        cycles = now;
+
+        if (instruction == end && first == begin)
+        {
+            for (uint8_t entry = 0; entry < block->retiredOpcodes; ++entry)
             {
-                setFlag(ZERO);
+                CoreCounters::add(counters.retired[block->retired[entry].first], block->retired[entry].second);
             }
-            else
+        }
+        else
+        {
+            for (const DecodedInstruction *retired = first; retired != instruction; ++retired)
             {
-                clearFlag(ZERO);
+                CoreCounters::add(counters.retired[retired->opcode]);
             }
+        }
+        executed += instruction - first;
 
-            if (static_cast<int64_t>(result) < 0)
-            {
-                setFlag(NEGATIVE);
-            }
-            else
+        // Chained blocks run without going back to the run loop, until something is due
+        if (instruction == end && running && now < deadline && !haltRequested.load(std::memory_order_relaxed))
+        {
+            syncBus();
+            const BasicBlock *next = currentBlock == block ? linkedBlock(*block) : nullptr;
+            if (next)
             {
-                clearFlag(NEGATIVE);
+                block = next;
+                currentBlock = block;
+                blockIndex = block->instructions.size();
+                i = 0;
+                goto enter;
             }
+        }
 
-            spdlog::debug("MUL R{} *= R{} -> {:#018x}", dest, src, r[dest]);
-            break;
+        return executed;
+    }
+
+    const BasicBlock *CPU::linkedBlock(const BasicBlock &block) const
+    {
+        // The block that followed last time, when the cache dropped nothing since
+        const BasicBlock::Link &link = block.successors[ip != block.endAddress];
+        if (link.block && link.epoch == icache.getEpoch() && link.block->startAddress == ip)
+        {
+            return link.block;
         }
+        return nullptr;
+    }
 
-        case static_cast<uint8_t>(InstructionType::DIV):
+    size_t CPU::traceBlock(const BasicBlock &block, size_t index)
+    {
+        // Every instruction gets its record, so fused pairs are run one instruction at a time
+        size_t executed = 0;
+        const std::vector<DecodedInstruction> &instructions = block.instructions;
+        for (; index < instructions.size(); ++index)
         {
-            uint8_t dest = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint8_t src = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
+            const DecodedInstruction &instruction = instructions[index];
+            ip += instruction.length;
+            cycles += instruction.cycles;
+            CoreCounters::add(counters.retired[instruction.opcode]);
+
+            beginTrace(instruction);
+            (this->*handlers[instruction.opcode])(instruction);
+            tracer->record(traceRecord);
+            ++executed;
 
-            if (r[src] != 0)
+            // Stop on halt, or when a write invalidated the block we are running from
+            if (!running || currentBlock != &block)
             {
-                uint64_t result = r[dest] / r[src];
-                r[dest] = result;
-
-                if (result == 0)
-                {
-                    setFlag(ZERO);
-                }
-                else
-                {
-                    clearFlag(ZERO);
-                }
-
-                if (static_cast<int64_t>(result) < 0)
-                {
-                    setFlag(NEGATIVE);
-                }
-                else
-                {
-                    clearFlag(NEGATIVE);
-                }
-
-                spdlog::debug("DIV R{} /= R{} -> {:#018x}", dest, src, r[dest]);
+                break;
             }
-            else
+
+            // Events fire after the same instruction as on the switch engine
+            if (cycles >= scheduler.getNextDeadline())
             {
-                spdlog::critical("Division by zero @ {:#016x}", ip);
-                halt();
+                blockIndex = index + 1;
+                break;
             }
-            break;
         }
 
-        case static_cast<uint8_t>(InstructionType::PUSH):
+        return executed;
+    }
+
+    void CPU::beginTrace(const DecodedInstruction &instruction)
+    {
+        traceRecord = TraceRecord{instruction.address, instruction.operand, 0, 0, instruction.opcode, instruction.reg1, instruction.reg2, TraceAccess::None, 0, {}};
+    }
+
+    void CPU::traceAccess(TraceAccess access, uint64_t address, uint64_t data, uint8_t size)
+    {
+        traceRecord.busAddress = address;
+        traceRecord.access = access;
+        traceRecord.data = size < 8 ? data & ((1ULL << (size * 8)) - 1) : data; // Stores pass the whole register
+        traceRecord.size = size;
+    }
+
+    void CPU::syncBus()
+    {
+        if (bus->getGeneration() != busGeneration)
         {
-            uint8_t reg = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            sp -= 8;
-            bus->write(sp, static_cast<uint8_t>(r[reg]));
-            spdlog::debug("PUSH R{} -> Stack @ {:#018x}", reg, sp);
-            break;
+            // Devices moved or changed state, decoded blocks and host pointers may be stale
+            icache.flush();
+            tlb.flush();
+            currentBlock = nullptr;
+            busGeneration = bus->getGeneration();
         }
+    }
 
-        case static_cast<uint8_t>(InstructionType::POP):
+    uint8_t CPU::readMemory(uint64_t address)
+    {
+        uint8_t data;
+        // Acquire and release on every access, so cores see each other's accesses in program order
+        if (const uint8_t *host = tlb.translate(*bus, address, false))
         {
-            uint8_t reg = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            r[reg] = bus->read(sp);
-            sp += 8;
-            spdlog::debug("POP Stack -> R{} = {:#018x}", reg, r[reg]);
-            break;
+            data = __atomic_load_n(host, __ATOMIC_ACQUIRE);
+        }
+        else
+        {
+            data = bus->read(address);
+            syncBus();
         }
 
-        case static_cast<uint8_t>(InstructionType::JMP):
+        if (tracer)
         {
-            uint64_t address = 0;
-            for (size_t i = 0; i < 8; ++i)
-            {
-                address |= static_cast<uint64_t>(bus->read(ip + i)) << (i * 8);
-            }
-            ip = address;
-            spdlog::debug("JMP -> {:#018x}", ip);
-            break;
+            traceAccess(TraceAccess::Read, address, data);
         }
+        return data;
+    }
 
-        case static_cast<uint8_t>(InstructionType::CMP):
+    void CPU::writeMemory(uint64_t address, uint8_t data)
+    {
+        if (tracer)
         {
-            uint8_t reg1 = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            uint8_t reg2 = static_cast<uint8_t>(bus->read(ip));
-            ip += 1;
-            if (r[reg1] == r[reg2])
-            {
-                setFlag(ZERO);
-            }
-            else
-            {
-                clearFlag(ZERO);
-            }
+            traceAccess(TraceAccess::Write, address, data);
+        }
 
-            if (static_cast<int64_t>(r[reg1] - r[reg2]) < 0)
-            {
-                setFlag(NEGATIVE);
-            }
-            else
-            {
-                clearFlag(NEGATIVE);
-            }
+        if (uint8_t *host = tlb.translate(*bus, address, true))
+        {
+            __atomic_store_n(host, data, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            bus->write(address, data);
+            syncBus();
+        }
 
-            spdlog::debug("CMP R{} == R{} -> FR = {}", reg1, reg2, fr);
-            break;
+        if (icache.invalidate(address))
+        {
+            currentBlock = nullptr;
         }
 
-        case static_cast<uint8_t>(InstructionType::JE):
+        if (jit)
         {
-            uint64_t address = 0;
-            for (size_t i = 0; i < 8; ++i)
-            {
-                address |= static_cast<uint64_t>(bus->read(ip + i)) << (i * 8);
-            }
-            ip += 8;
-            if (isFlagSet(ZERO))
-            {
-                ip = address;
-                spdlog::debug("JE -> {:#018x}", ip);
-            }
-            break;
+            jit->invalidate(address);
         }
+    }
 
-        case static_cast<uint8_t>(InstructionType::JNE):
+    uint64_t CPU::loadMemory(uint64_t address, uint8_t size)
+    {
+        uint64_t data;
+        const uint8_t *host = tlb.translate(*bus, address, false);
+
+        // Aligned accesses cannot leave the page, and are as atomic as byte accesses
+        if (host && (address & (size - 1)) == 0)
         {
-            uint64_t address = 0;
-            for (size_t i = 0; i < 8; ++i)
+            switch (size)
             {
-                address |= static_cast<uint64_t>(bus->read(ip + i)) << (i * 8);
+            case 1:
+                data = __atomic_load_n(host, __ATOMIC_ACQUIRE);
+                break;
+            case 2:
+                data = __atomic_load_n(reinterpret_cast<const uint16_t *>(host), __ATOMIC_ACQUIRE);
+                break;
+            case 4:
+                data = __atomic_load_n(reinterpret_cast<const uint32_t *>(host), __ATOMIC_ACQUIRE);
+                break;
+            default:
+                data = __atomic_load_n(reinterpret_cast<const uint64_t *>(host), __ATOMIC_ACQUIRE);
+                break;
             }
-            ip += 8;
-            if (!isFlagSet(ZERO))
+        }
+        else
+        {
+            switch (size)
             {
-                ip = address;
-                spdlog::debug("JNE -> {:#018x}", ip);
+            case 1:
+                data = bus->read(address);
+                break;
+            case 2:
+                data = bus->read16(address);
+                break;
+            case 4:
+                data = bus->read32(address);
+                break;
+            default:
+                data = bus->read64(address);
+                break;
             }
-            break;
+            syncBus();
         }
 
-        default:
-            spdlog::critical("Unknown instruction at IP {:#016x} ({:#04x})", ip, opcode);
-            halt();
-            break;
+        if (tracer)
+        {
+            traceAccess(TraceAccess::Read, address, data, size);
         }
+        return data;
     }
 
-    void CPU::step()
-    {
-        spdlog::trace("CPU stepping. Current IP: {:#016x}", ip);
-        fetchInstructions();
-    }
-
-    void CPU::run()
+    void CPU::storeMemory(uint64_t address, uint64_t data, uint8_t size)
     {
-        using namespace std::chrono;
-
-        running = true;
-        constexpr int64_t targetTimePerCycle = 1000000 / 1000000; // 1 MHz clock speed
-
-        while (running)
+        if (tracer)
         {
-            auto start = steady_clock::now();
-            step();
-            auto end = steady_clock::now();
-
-            auto stepDuration = duration_cast<microseconds>(end - start).count();
-            int64_t sleepDuration = targetTimePerCycle - stepDuration;
+            traceAccess(TraceAccess::Write, address, data, size);
+        }
 
-            if (sleepDuration > 0)
+        uint8_t *host = tlb.translate(*bus, address, true);
+        if (host && (address & (size - 1)) == 0)
+        {
+            switch (size)
+            {
+            case 1:
+                __atomic_store_n(host, static_cast<uint8_t>(data), __ATOMIC_RELEASE);
+                break;
+            case 2:
+                __atomic_store_n(reinterpret_cast<uint16_t *>(host), static_cast<uint16_t>(data), __ATOMIC_RELEASE);
+                break;
+            case 4:
+                __atomic_store_n(reinterpret_cast<uint32_t *>(host), static_cast<uint32_t>(data), __ATOMIC_RELEASE);
+                break;
+            default:
+                __atomic_store_n(reinterpret_cast<uint64_t *>(host), data, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+        else
+        {
+            switch (size)
             {
-                std::this_thread::sleep_for(microseconds(sleepDuration));
+            case 1:
+                bus->write(address, static_cast<uint8_t>(data));
+                break;
+            case 2:
+                bus->write16(address, static_cast<uint16_t>(data));
+                break;
+            case 4:
+                bus->write32(address, static_cast<uint32_t>(data));
+                break;
+            default:
+                bus->write64(address, data);
+                break;
             }
+            syncBus();
+        }
 
-            spdlog::trace("Step completed in {} microseconds. Sleeping for {} microseconds to maintain 1 MHz.", stepDuration, sleepDuration > 0 ? sleepDuration : 0);
+        if (icache.invalidate(address, size))
+        {
+            currentBlock = nullptr;
         }
-    }
 
-    void CPU::halt()
-    {
-        spdlog::debug("CPU halt requested");
-        running = false;
+        if (jit)
+        {
+            jit->invalidate(address, size);
+        }
     }
 
-    std::shared_ptr<Bus> &CPU::getBus()
+    const CPU::HandlerTable CPU::handlers = CPU::buildHandlerTable();
+
+    CPU::HandlerTable CPU::buildHandlerTable()
     {
-        return bus;
+        HandlerTable table;
+        table.fill(&CPU::execUnknown);
+
+        table[InstructionType::NOP] = &CPU::execNop;
+        table[InstructionType::HLT] = &CPU::execHlt;
+        table[InstructionType::WRITE] = &CPU::execWrite;
+        table[InstructionType::READ] = &CPU::execRead;
+        table[InstructionType::LDI] = &CPU::execLdi;
+        table[InstructionType::ADD] = &CPU::execAdd;
+        table[InstructionType::SUB] = &CPU::execSub;
+        table[InstructionType::MUL] = &CPU::execMul;
+        table[InstructionType::DIV] = &CPU::execDiv;
+        table[InstructionType::PUSH] = &CPU::execPush;
+        table[InstructionType::POP] = &CPU::execPop;
+        table[InstructionType::JMP] = &CPU::execJmp;
+        table[InstructionType::CMP] = &CPU::execCmp;
+        table[InstructionType::JE] = &CPU::execJe;
+        table[InstructionType::JNE] = &CPU::execJne;
+        table[InstructionType::LD8] = &CPU::execLoad;
+        table[InstructionType::LD16] = &CPU::execLoad;
+        table[InstructionType::LD32] = &CPU::execLoad;
+        table[InstructionType::LD64] = &CPU::execLoad;
+        table[InstructionType::ST8] = &CPU::execStore;
+        table[InstructionType::ST16] = &CPU::execStore;
+        table[InstructionType::ST32] = &CPU::execStore;
+        table[InstructionType::ST64] = &CPU::execStore;
+
+        return table;
     }
 
-    void CPU::setRegister(size_t index, uint64_t value)
+    void CPU::execute(const DecodedInstruction &instruction)
     {
-        if (index >= r.size())
+        switch (instruction.opcode)
         {
-            throw std::out_of_range("Register index out of range");
-        }
-        r[index] = value;
+        case static_cast<uint8_t>(InstructionType::NOP):
+            execNop(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::HLT):
+            execHlt(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::WRITE):
+            execWrite(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::READ):
+            execRead(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::LDI):
+            execLdi(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::ADD):
+            execAdd(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::SUB):
+            execSub(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::MUL):
+            execMul(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::DIV):
+            execDiv(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::PUSH):
+            execPush(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::POP):
+            execPop(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::JMP):
+            execJmp(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::CMP):
+            execCmp(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::JE):
+            execJe(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::JNE):
+            execJne(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::LD8):
+        case static_cast<uint8_t>(InstructionType::LD16):
+        case static_cast<uint8_t>(InstructionType::LD32):
+        case static_cast<uint8_t>(InstructionType::LD64):
+            execLoad(instruction);
+            break;
+        case static_cast<uint8_t>(InstructionType::ST8):
+        case static_cast<uint8_t>(InstructionType::ST16):
+        case static_cast<uint8_t>(InstructionType::ST32):
+        case static_cast<uint8_t>(InstructionType::ST64):
+            execStore(instruction);
+            break;
+        default:
+            execUnknown(instruction);
+            break;
+        }
+    }
+
+    void CPU::execNop([[maybe_unused]] const DecodedInstruction &instruction)
+    {
+        SPDLOG_DEBUG("NOP @ {:#016x}", instruction.address);
+    }
+
+    void CPU::execHlt([[maybe_unused]] const DecodedInstruction &instruction)
+    {
+        SPDLOG_DEBUG("HLT @ {:#016x}", ip);
+        halt();
+    }
+
+    void CPU::execWrite(const DecodedInstruction &instruction)
+    {
+        uint8_t regIn = instruction.reg1;
+        uint64_t address = instruction.operand;
+
+        uint64_t valueToWrite = getRegister(regIn);
+        SPDLOG_DEBUG("WRITE @ {:#016x}, Register R{} = {:#018x}", address, regIn, valueToWrite);
+        writeMemory(address, static_cast<uint8_t>(valueToWrite));
+    }
+
+    void CPU::execRead(const DecodedInstruction &instruction)
+    {
+        uint8_t regOut = instruction.reg1;
+        uint64_t address = instruction.operand;
+
+        uint8_t valueRead = readMemory(address);
+        setRegister(regOut, valueRead);
+        SPDLOG_DEBUG("READ @ {:#016x}, Register R{} = {:#018x}", address, regOut, valueRead);
+    }
+
+    void CPU::execLdi(const DecodedInstruction &instruction)
+    {
+        uint8_t regOut = instruction.reg1;
+        uint64_t immediateValue = instruction.operand;
+
+        setRegister(regOut, immediateValue);
+        SPDLOG_DEBUG("LDI @ {:#016x}, Register R{} = {:#018x}", instruction.address, regOut, immediateValue);
+    }
+
+    void CPU::execAdd(const DecodedInstruction &instruction)
+    {
+        addRegisters(instruction, r[instruction.reg1], true);
+    }
+
+    void CPU::execSub(const DecodedInstruction &instruction)
+    {
+        subRegisters(instruction, r[instruction.reg1], true);
+    }
+
+    void CPU::execMul(const DecodedInstruction &instruction)
+    {
+        mulRegisters(instruction, r[instruction.reg1], true);
+    }
+
+    uint64_t CPU::addRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags)
+    {
+        uint8_t dest = instruction.reg1;
+        uint8_t src = instruction.reg2;
+        uint64_t right = r[src];
+        uint64_t result = left + right;
+        if (flags)
+        {
+            setFlags(FlagSource::Add, left, right, result);
+        }
+        r[dest] = result;
+
+        SPDLOG_DEBUG("ADD R{} += R{} -> {:#018x}", dest, src, result);
+        return result;
+    }
+
+    uint64_t CPU::subRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags)
+    {
+        uint8_t dest = instruction.reg1;
+        uint8_t src = instruction.reg2;
+        uint64_t right = r[src];
+        uint64_t result = left - right;
+        if (flags)
+        {
+            setFlags(FlagSource::Sub, left, right, result);
+        }
+        r[dest] = result;
+
+        SPDLOG_DEBUG("SUB R{} -= R{} -> {:#018x}", dest, src, result);
+        return result;
+    }
+
+    uint64_t CPU::mulRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags)
+    {
+        uint8_t dest = instruction.reg1;
+        uint8_t src = instruction.reg2;
+        uint64_t right = r[src];
+        uint64_t result = left * right;
+        if (flags)
+        {
+            setFlags(FlagSource::Mul, left, right, result);
+        }
+        r[dest] = result;
+
+        SPDLOG_DEBUG("MUL R{} *= R{} -> {:#018x}", dest, src, result);
+        return result;
+    }
+
+    void CPU::execDiv(const DecodedInstruction &instruction)
+    {
+        uint8_t dest = instruction.reg1;
+        uint8_t src = instruction.reg2;
+
+        if (r[src] != 0)
+        {
+            uint64_t result = r[dest] / r[src];
+            setFlags(FlagSource::Div, r[dest], r[src], result);
+            r[dest] = result;
+
+            SPDLOG_DEBUG("DIV R{} /= R{} -> {:#018x}", dest, src, r[dest]);
+        }
+        else
+        {
+            spdlog::critical("Division by zero @ {:#016x}", ip);
+            halt();
+        }
+    }
+
+    void CPU::execPush(const DecodedInstruction &instruction)
+    {
+        uint8_t reg = instruction.reg1;
+        sp -= 8;
+        writeMemory(sp, static_cast<uint8_t>(r[reg]));
+        SPDLOG_DEBUG("PUSH R{} -> Stack @ {:#018x}", reg, sp);
+    }
+
+    void CPU::execPop(const DecodedInstruction &instruction)
+    {
+        uint8_t reg = instruction.reg1;
+        r[reg] = readMemory(sp);
+        sp += 8;
+        SPDLOG_DEBUG("POP Stack -> R{} = {:#018x}", reg, r[reg]);
+    }
+
+    void CPU::execJmp(const DecodedInstruction &instruction)
+    {
+        ip = instruction.operand;
+        SPDLOG_DEBUG("JMP -> {:#018x}", ip);
+        if (profiler)
+        {
+            profiler->jump(instruction.address, ip);
+        }
+    }
+
+    void CPU::execCmp(const DecodedInstruction &instruction)
+    {
+        compareRegisters(instruction, r[instruction.reg1], true);
+    }
+
+    void CPU::compareRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags)
+    {
+        if (flags)
+        {
+            uint64_t right = r[instruction.reg2];
+            setFlags(FlagSource::Sub, left, right, left - right);
+
+            SPDLOG_DEBUG("CMP R{} == R{} -> FR = {}", instruction.reg1, instruction.reg2, computeFlags());
+        }
+    }
+
+    void CPU::execJe(const DecodedInstruction &instruction)
+    {
+        uint64_t address = instruction.operand;
+        if (isFlagSet(ZERO))
+        {
+            ip = address;
+            SPDLOG_DEBUG("JE -> {:#018x}", ip);
+            if (profiler)
+            {
+                profiler->jump(instruction.address, ip);
+            }
+        }
+    }
+
+    void CPU::execJne(const DecodedInstruction &instruction)
+    {
+        uint64_t address = instruction.operand;
+        if (!isFlagSet(ZERO))
+        {
+            ip = address;
+            SPDLOG_DEBUG("JNE -> {:#018x}", ip);
+            if (profiler)
+            {
+                profiler->jump(instruction.address, ip);
+            }
+        }
+    }
+
+    void CPU::execLoad(const DecodedInstruction &instruction)
+    {
+        uint8_t regOut = instruction.reg1;
+        uint64_t address = getRegister(instruction.reg2) + instruction.operand;
+
+        uint64_t valueRead = loadMemory(address, accessSize(instruction.opcode));
+        setRegister(regOut, valueRead);
+        SPDLOG_DEBUG("{} @ {:#016x}, Register R{} = {:#018x}", instructionName(instruction.opcode), address, regOut, valueRead);
+    }
+
+    void CPU::execStore(const DecodedInstruction &instruction)
+    {
+        uint8_t regIn = instruction.reg1;
+        uint64_t address = getRegister(instruction.reg2) + instruction.operand;
+
+        uint64_t valueToWrite = getRegister(regIn);
+        SPDLOG_DEBUG("{} @ {:#016x}, Register R{} = {:#018x}", instructionName(instruction.opcode), address, regIn, valueToWrite);
+        storeMemory(address, valueToWrite, accessSize(instruction.opcode));
+    }
+
+    void CPU::execUnknown(const DecodedInstruction &instruction)
+    {
+        spdlog::critical("Unknown instruction at IP {:#016x} ({:#04x})", ip, instruction.opcode);
+        halt();
+    }
+
+    void CPU::execStoreImmediate(const DecodedInstruction &load, const DecodedInstruction &store)
+    {
+        r[load.reg1] = load.operand;
+        SPDLOG_DEBUG("LDI+WRITE @ {:#016x}, Register R{} = {:#018x}", store.operand, load.reg1, load.operand);
+        writeMemory(store.operand, static_cast<uint8_t>(load.operand));
+    }
+
+    void CPU::execCompareBranch(const DecodedInstruction &compare, const DecodedInstruction &branch)
+    {
+        uint64_t left = r[compare.reg1];
+        uint64_t right = r[compare.reg2];
+        bool equal = left == right;
+
+        // Left for the code at either target to compute if it reads the flags at all
+        setFlags(FlagSource::Sub, left, right, left - right);
+
+        if (equal == (branch.opcode == InstructionType::JE))
+        {
+            ip = branch.operand;
+            if (profiler)
+            {
+                profiler->jump(branch.address, ip);
+            }
+        }
+        SPDLOG_DEBUG("CMP+{} R{} == R{} -> {:#018x}", instructionName(branch.opcode), compare.reg1, compare.reg2, ip);
+    }
+
+    void CPU::step()
+    {
+        SPDLOG_TRACE("CPU stepping. Current IP: {:#016x}", ip);
+        fetchInstructions();
+    }
+
+    void CPU::run()
+    {
+        CPU *previous = currentCore;
+        currentCore = this;
+        running = true;
+        startStats();
+        if (profiler)
+        {
+            profileEvent = scheduler.schedule(cycles + profiler->getInterval(), [this](uint64_t) { takeSample(); });
+        }
+
+        switch (engine)
+        {
+        case Engine::Threaded:
+            runThreaded();
+            break;
+
+        case Engine::Jit:
+            if (tracer || profiler)
+            {
+                // Translated code does not report the instructions it runs, nor the jumps it takes
+                spdlog::warn("Tracing and profiling are not supported by the JIT, using the threaded engine");
+                runThreaded();
+                break;
+            }
+            runJit();
+            break;
+
+        default:
+            runSwitch();
+            break;
+        }
+
+        if (statsEvent)
+        {
+            scheduler.cancel(statsEvent);
+        }
+        publishStats();
+        if (profileEvent)
+        {
+            scheduler.cancel(profileEvent);
+            profileEvent = 0;
+        }
+        currentCore = previous;
+    }
+
+    void CPU::startClock()
+    {
+        clockBase = std::chrono::steady_clock::now();
+        clockBaseCycles = cycles;
+
+        if (clockEvent)
+        {
+            scheduler.cancel(clockEvent);
+        }
+        syncClock();
+
+        // Events that came due while the CPU was stopped fire before the first instruction
+        scheduler.runDue(cycles);
+    }
+
+    void CPU::syncClock()
+    {
+        using namespace std::chrono;
+
+        clockEvent = 0;
+        if (clockFrequency == 0)
+        {
+            return;
+        }
+
+        // Sleep until the host catches up with the emulated clock, split to keep the product in range
+        uint64_t elapsed = cycles - clockBaseCycles;
+        auto target = clockBase + nanoseconds(elapsed / clockFrequency * 1000000000ULL + elapsed % clockFrequency * 1000000000ULL / clockFrequency);
+        auto now = steady_clock::now();
+
+        if (target > now)
+        {
+            std::this_thread::sleep_until(target);
+        }
+        else if (now - target > milliseconds(SX64_CLOCK_MAX_LAG_MS))
+        {
+            // The host cannot keep up, run at its pace rather than bursting to catch up later
+            SPDLOG_TRACE("Clock fell {} ms behind, resetting the schedule", duration_cast<milliseconds>(now - target).count());
+            clockBase = now;
+            clockBaseCycles = cycles;
+        }
+
+        uint64_t period = std::max<uint64_t>(clockFrequency * SX64_CLOCK_SYNC_MS / 1000, 1);
+        clockEvent = scheduler.schedule(cycles + period, [this](uint64_t) { syncClock(); });
+    }
+
+    void CPU::startStats()
+    {
+        runStart = std::chrono::steady_clock::now();
+        statsHostBase = CoreCounters::read(counters.hostNanoseconds);
+        statsCycles = cycles; // A restored snapshot may have moved the count
+
+        if (statsEvent)
+        {
+            scheduler.cancel(statsEvent);
+        }
+        publishStats();
+    }
+
+    void CPU::publishStats()
+    {
+        using namespace std::chrono;
+
+        statsEvent = 0;
+        uint64_t elapsed = cycles - statsCycles;
+        if (clockFrequency)
+        {
+            // Split like syncClock to keep the product in range
+            CoreCounters::add(counters.emulatedNanoseconds, elapsed / clockFrequency * 1000000000ULL + elapsed % clockFrequency * 1000000000ULL / clockFrequency);
+        }
+        statsCycles = cycles;
+
+        uint64_t host = duration_cast<nanoseconds>(steady_clock::now() - runStart).count();
+        CoreCounters::set(counters.hostNanoseconds, statsHostBase + host);
+        CoreCounters::set(counters.cycles, cycles);
+
+        if (running)
+        {
+            statsEvent = scheduler.schedule(cycles + SX64_STATS_PUBLISH_CYCLES, [this](uint64_t) { publishStats(); });
+        }
+    }
+
+    void CPU::takeSample()
+    {
+        profiler->sample(ip);
+        profileEvent = running ? scheduler.schedule(cycles + profiler->getInterval(), [this](uint64_t) { takeSample(); }) : 0;
+    }
+
+    void CPU::runSwitch()
+    {
+        startClock();
+
+        while (running)
+        {
+            step();
+
+            if (cycles >= scheduler.getNextDeadline())
+            {
+                scheduler.runDue(cycles);
+            }
+
+            if (haltRequested.load(std::memory_order_relaxed))
+            {
+                halt();
+            }
+        }
+    }
+
+    void CPU::runThreaded()
+    {
+        startClock();
+
+        while (running)
+        {
+            [[maybe_unused]] size_t blockExecuted = executeBlock();
+
+            if (cycles >= scheduler.getNextDeadline())
+            {
+                scheduler.runDue(cycles);
+            }
+
+            if (haltRequested.load(std::memory_order_relaxed))
+            {
+                halt();
+            }
+
+            SPDLOG_TRACE("Block of {} instructions completed, {} cycles in total.", blockExecuted, cycles);
+        }
+    }
+
+    void CPU::runJit()
+    {
+        if (!jit)
+        {
+            jit = std::make_unique<Jit>(*this);
+        }
+
+        if (!jit->isAvailable())
+        {
+            spdlog::warn("JIT is not available on this host, falling back to the threaded engine");
+            runThreaded();
+            return;
+        }
+
+        startClock();
+        materializeFlags();
+
+        while (running)
+        {
+            // Return to the dispatcher right at the next event, the JIT does not run past its budget
+            uint64_t slice = std::min<uint64_t>(scheduler.getNextDeadline() - cycles, SX64_JIT_SLICE_CYCLES);
+            uint64_t sliceCycles = jit->run(slice);
+            cycles += sliceCycles;
+
+            if (cycles >= scheduler.getNextDeadline())
+            {
+                scheduler.runDue(cycles);
+            }
+
+            if (haltRequested.load(std::memory_order_relaxed))
+            {
+                halt();
+            }
+
+            SPDLOG_TRACE("JIT slice of {} cycles completed, {} cycles in total.", sliceCycles, cycles);
+        }
+    }
+
+    void CPU::halt()
+    {
+        spdlog::debug("CPU halt requested");
+        running = false;
+    }
+
+    void CPU::requestHalt()
+    {
+        // Safe from any thread, unlike halt() which only the thread running the CPU may call
+        haltRequested.store(true, std::memory_order_relaxed);
+    }
+
+    void CPU::start(uint64_t address, uint64_t stack)
+    {
+        // Reset state of a secondary core. Another core may have rewritten the code it ran before.
+        std::fill(r.begin(), r.end(), 0);
+        fr = 0;
+        flagSource = FlagSource::None;
+        sb = stack;
+        sp = stack;
+        ip = address;
+        icache.flush();
+        tlb.flush();
+        currentBlock = nullptr;
+        if (jit)
+        {
+            jit->flush();
+        }
+    }
+
+    uint64_t CPU::getId() const
+    {
+        return id;
+    }
+
+    CPU *CPU::getCurrent()
+    {
+        return currentCore;
+    }
+
+    void CPU::setEngine(Engine engine)
+    {
+        this->engine = engine;
+    }
+
+    Engine CPU::getEngine() const
+    {
+        return engine;
+    }
+
+    void CPU::setClockFrequency(uint64_t frequency)
+    {
+        clockFrequency = frequency;
+    }
+
+    uint64_t CPU::getClockFrequency() const
+    {
+        return clockFrequency;
+    }
+
+    uint64_t CPU::getCycles() const
+    {
+        return cycles;
+    }
+
+    Scheduler &CPU::getScheduler()
+    {
+        return scheduler;
+    }
+
+    CoreCounters &CPU::getCounters()
+    {
+        return counters;
+    }
+
+    void CPU::setTracer(TraceWriter *tracer)
+    {
+        this->tracer = tracer;
+    }
+
+    void CPU::setProfiler(Profiler *profiler)
+    {
+        this->profiler = profiler;
+    }
+
+    static std::string resolvePath(const std::string &path)
+    {
+        char *resolved = realpath(path.c_str(), nullptr);
+        if (!resolved)
+        {
+            return path;
+        }
+
+        std::string result = resolved;
+        std::free(resolved);
+        return result;
+    }
+
+    bool CPU::saveSnapshot(const std::string &path, SnapshotKind kind)
+    {
+        const auto &devices = bus->getDevices();
+
+        if (kind == SnapshotKind::Delta)
+        {
+            if (snapshotBase.empty())
+            {
+                spdlog::error("Cannot save delta snapshot \"{}\" without a snapshot to base it on", path);
+                return false;
+            }
+
+            if (resolvePath(path) == snapshotBase)
+            {
+                spdlog::error("Delta snapshot \"{}\" would replace its own base", path);
+                return false;
+            }
+        }
+
+        SnapshotWriter writer;
+        if (!writer.open(path))
+        {
+            return false;
+        }
+        materializeFlags();
+
+        SnapshotFileHeader header{};
+        std::memcpy(header.magic, SX64_SNAPSHOT_MAGIC, sizeof(SX64_SNAPSHOT_MAGIC));
+        header.version = SX64_SNAPSHOT_VERSION;
+        header.deviceCount = static_cast<uint32_t>(devices.size());
+        header.kind = kind;
+
+        bool saved = writer.write(header) && (kind == SnapshotKind::Full || writer.writeString(snapshotBase)) &&
+                     writer.write(r.data(), r.size() * sizeof(uint64_t)) &&
+                     writer.write(sb) && writer.write(sp) && writer.write(ip) && writer.write(fr) && writer.write(cycles);
+
+        // Devices are matched up by attach order and name, restoring needs the same machine layout
+        for (const auto &device : devices)
+        {
+            saved = saved && writer.writeString(device->getName()) &&
+                    (kind == SnapshotKind::Full ? device->saveState(writer) : device->saveDelta(writer));
+        }
+
+        if (!saved || !writer.commit())
+        {
+            spdlog::error("Could not save snapshot \"{}\"", path);
+            return false;
+        }
+
+        // Start tracking writes afresh. Cached write translations marked their pages when they
+        // were filled, drop them so the next write to each page is seen again.
+        for (const auto &device : devices)
+        {
+            device->checkpoint();
+        }
+        tlb.flush();
+        snapshotBase = resolvePath(path);
+
+        spdlog::debug("{} snapshot saved to \"{}\" at IP {:#016x}", kind == SnapshotKind::Full ? "Full" : "Delta", path, ip);
+        return true;
+    }
+
+    bool CPU::loadSnapshot(const std::string &path)
+    {
+        if (!restoreSnapshot(path, 0))
+        {
+            return false;
+        }
+
+        for (const auto &device : bus->getDevices())
+        {
+            device->checkpoint();
+        }
+        snapshotBase = resolvePath(path);
+
+        // Memory changed underneath every decoded block, host pointer and translation
+        bus->rebuildDecodeTable();
+        syncBus();
+
+        spdlog::debug("Snapshot \"{}\" restored at IP {:#016x}", path, ip);
+        return true;
+    }
+
+    bool CPU::restoreSnapshot(const std::string &path, int depth)
+    {
+        const auto &devices = bus->getDevices();
+
+        SnapshotReader reader;
+        if (!reader.open(path))
+        {
+            return false;
+        }
+
+        SnapshotFileHeader header;
+        if (!reader.read(header) || std::memcmp(header.magic, SX64_SNAPSHOT_MAGIC, sizeof(SX64_SNAPSHOT_MAGIC)) != 0)
+        {
+            spdlog::error("\"{}\" is not an sx64 snapshot", path);
+            return false;
+        }
+
+        if (header.version != SX64_SNAPSHOT_VERSION)
+        {
+            spdlog::error("Snapshot \"{}\" has unsupported version {}", path, header.version);
+            return false;
+        }
+
+        if (header.deviceCount != devices.size())
+        {
+            spdlog::error("Snapshot \"{}\" holds {} devices, the machine has {}", path, header.deviceCount, devices.size());
+            return false;
+        }
+
+        if (header.kind == SnapshotKind::Delta)
+        {
+            // Rebuild the base first, possibly through a chain of earlier deltas
+            std::string base;
+            if (!reader.readString(base))
+            {
+                return false;
+            }
+
+            if (depth >= SX64_SNAPSHOT_MAX_CHAIN)
+            {
+                spdlog::error("Snapshot \"{}\" is part of a delta chain that is too long or loops", path);
+                return false;
+            }
+
+            if (!restoreSnapshot(base, depth + 1))
+            {
+                spdlog::error("Could not restore \"{}\", the base of delta snapshot \"{}\"", base, path);
+                return false;
+            }
+        }
+        else if (header.kind != SnapshotKind::Full)
+        {
+            spdlog::error("Snapshot \"{}\" is of unknown kind {}", path, static_cast<uint32_t>(header.kind));
+            return false;
+        }
+
+        if (!reader.read(r.data(), r.size() * sizeof(uint64_t)) || !reader.read(sb) || !reader.read(sp) ||
+            !reader.read(ip) || !reader.read(fr) || !reader.read(cycles))
+        {
+            return false;
+        }
+        flagSource = FlagSource::None;
+
+        for (const auto &device : devices)
+        {
+            std::string name;
+            if (!reader.readString(name))
+            {
+                return false;
+            }
+
+            if (name != device->getName())
+            {
+                spdlog::error("Snapshot \"{}\" holds device \"{}\" where the machine has \"{}\"", path, name, device->getName());
+                return false;
+            }
+
+            if (!(header.kind == SnapshotKind::Full ? device->loadState(reader) : device->loadDelta(reader)))
+            {
+                spdlog::error("Could not restore device \"{}\" from snapshot \"{}\"", name, path);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::shared_ptr<Bus> &CPU::getBus()
+    {
+        return bus;
+    }
+
+    void CPU::setRegister(size_t index, uint64_t value)
+    {
+        if (index >= r.size())
+        {
+            throw std::out_of_range("Register index out of range");
+        }
+        r[index] = value;
+    }
+
+    uint16_t CPU::getFlags() const
+    {
+        return computeFlags();
     }
 
     uint64_t CPU::getRegister(size_t index) const
@@ -406,7 +1530,7 @@ namespace sx64
         spdlog::debug("SB: {:#018x} ({})", sb, sb);
         spdlog::debug("SP: {:#018x} ({})", sp, sp);
         spdlog::debug("IP: {:#018x} ({})", ip, ip);
-        spdlog::debug("FR: {:#06x} ({})", fr, fr);
+        spdlog::debug("FR: {:#06x} ({})", getFlags(), getFlags());
 
         spdlog::debug("Memory Layout:");
 
@@ -4,10 +4,26 @@
 #include <cstdint>
 #include <memory>
 #include <core/bus.hpp>
+#include <core/decoder.hpp>
+#include <core/jit.hpp>
+#include <core/tlb.hpp>
+#include <core/trace.hpp>
+#include <core/profiler.hpp>
+#include <core/snapshot.hpp>
+#include <core/scheduler.hpp>
+#include <core/stats.hpp>
 #include <devices/memory.hpp>
 #include <chrono>
+#include <atomic>
+#include <array>
+#include <string>
 
 #define SX64_ADDR_SYS_BOOTSTRAP 0x0000
+#define SX64_MAX_CORES 64
+#define SX64_JIT_SLICE_CYCLES 65536
+#define SX64_DEFAULT_CLOCK_FREQUENCY 1000000 // 1 MHz
+#define SX64_CLOCK_SYNC_MS 2                 // Emulated time between resyncs with the host clock
+#define SX64_CLOCK_MAX_LAG_MS 100            // Give up catching up when the host falls further behind
 
 namespace sx64
 {
@@ -27,7 +43,15 @@ namespace sx64
         JMP = 0x0B,
         CMP = 0x0C,
         JE = 0x0D,
-        JNE = 0x0E
+        JNE = 0x0E,
+        LD8 = 0x0F, // LDn and STn move n bits between a register and [base register + displacement]
+        LD16 = 0x10,
+        LD32 = 0x11,
+        LD64 = 0x12,
+        ST8 = 0x13,
+        ST16 = 0x14,
+        ST32 = 0x15,
+        ST64 = 0x16
     };
 
     enum Flag
@@ -38,32 +62,163 @@ namespace sx64
         OVERFLOW = 0x08  // Overflow flag
     };
 
+    // Instruction that last set the flags, fr is computed from its operands and result when read
+    enum class FlagSource : uint8_t
+    {
+        None, // fr is up to date
+        Add,
+        Sub,  // SUB and CMP
+        Mul,
+        Div
+    };
+
+    enum class Engine
+    {
+        Switch,  // Opcode switch, one instruction per step
+        Threaded, // Computed goto over whole decoded blocks, chained
+        Jit       // Native x86-64 translation of whole blocks
+    };
+
     class CPU
     {
     private:
-        std::vector<uint64_t> r; // General purpose registers R0-R7
+        using Handler = void (CPU::*)(const DecodedInstruction &);
+        using HandlerTable = std::array<Handler, 256>;
+
+        std::array<uint64_t, 8> r; // General purpose registers R0-R7
         uint64_t sb;             // Stack Base
         uint64_t sp;             // Stack Pointer
         uint64_t ip;             // Instruction Pointer
-        uint16_t fr;             // Flags Register
-        std::shared_ptr<Bus> bus;
+        uint16_t fr;             // Flags Register, stale while flagSource is set
+        FlagSource flagSource;
+        uint64_t flagLeft;
+        uint64_t flagRight;
+        uint64_t flagResult;
+        std::shared_ptr<Bus> bus; // Shared by every core of the machine
+        uint64_t id;              // Core index, 0 is the boot core
+        CoreCounters counters;
         bool running;
-        std::chrono::steady_clock::time_point lastStepTime;
+        std::atomic<bool> haltRequested; // Set from other threads, the run loop halts when it sees it
+        uint64_t cycles;         // Emulated clock cycles since power on
+        uint64_t clockFrequency; // Hz, 0 runs unthrottled
+        uint64_t clockBaseCycles;
+        Scheduler scheduler;
+        Scheduler::EventId clockEvent; // Pending resync with the host clock, 0 when unthrottled
+        std::chrono::steady_clock::time_point clockBase; // Host time at clockBaseCycles
+        Scheduler::EventId statsEvent; // Pending update of the time counters
+        uint64_t statsCycles;          // Cycles already counted as emulated time
+        uint64_t statsHostBase;        // Host nanoseconds of earlier runs
+        std::chrono::steady_clock::time_point runStart;
+        InstructionCache icache;
+        const BasicBlock *currentBlock; // Block the next instruction is expected to come from
+        size_t blockIndex;
+        uint64_t busGeneration; // Bus layout the cached blocks were decoded against
+        Engine engine;
+        std::unique_ptr<Jit> jit;
+        Tlb tlb;
+        TraceWriter *tracer;      // Null unless --trace is given
+        TraceRecord traceRecord; // Instruction being traced, completed by its memory access
+        Profiler *profiler;      // Null unless --profile is given
+        Scheduler::EventId profileEvent; // Pending sample
+        std::string snapshotBase;  // Last snapshot saved or restored, deltas are taken against it
+
+        static const HandlerTable handlers;
+        static HandlerTable buildHandlerTable();
 
         void fetchInstructions();
-        void setFlag(Flag flag);
-        void clearFlag(Flag flag);
+        void execute(const DecodedInstruction &instruction);
+        const BasicBlock *lookupBlock(uint64_t address);
+        size_t executeBlock();
+        size_t traceBlock(const BasicBlock &block, size_t index);
+        const BasicBlock *linkedBlock(const BasicBlock &block) const;
+        void startClock();
+        void syncClock();
+        void startStats();
+        void publishStats();
+        void takeSample();
+        void runSwitch();
+        void runThreaded();
+        void runJit();
+        uint64_t interpretInstruction();
+        void reportFetchFault(uint64_t address);
+        void beginTrace(const DecodedInstruction &instruction);
+        void traceAccess(TraceAccess access, uint64_t address, uint64_t data, uint8_t size = 1);
+        void syncBus();
+        bool restoreSnapshot(const std::string &path, int depth);
+        uint8_t readMemory(uint64_t address);
+        void writeMemory(uint64_t address, uint8_t data);
+        uint64_t loadMemory(uint64_t address, uint8_t size); // Little-endian, size is 1, 2, 4 or 8 bytes
+        void storeMemory(uint64_t address, uint64_t data, uint8_t size);
+
+        void execNop(const DecodedInstruction &instruction);
+        void execHlt(const DecodedInstruction &instruction);
+        void execWrite(const DecodedInstruction &instruction);
+        void execRead(const DecodedInstruction &instruction);
+        void execLdi(const DecodedInstruction &instruction);
+        void execAdd(const DecodedInstruction &instruction);
+        void execSub(const DecodedInstruction &instruction);
+        void execMul(const DecodedInstruction &instruction);
+        void execDiv(const DecodedInstruction &instruction);
+        void execPush(const DecodedInstruction &instruction);
+        void execPop(const DecodedInstruction &instruction);
+        void execJmp(const DecodedInstruction &instruction);
+        void execCmp(const DecodedInstruction &instruction);
+        void execJe(const DecodedInstruction &instruction);
+        void execJne(const DecodedInstruction &instruction);
+        void execLoad(const DecodedInstruction &instruction);
+        void execStore(const DecodedInstruction &instruction);
+        void execUnknown(const DecodedInstruction &instruction);
+        void execStoreImmediate(const DecodedInstruction &load, const DecodedInstruction &store);
+        void execCompareBranch(const DecodedInstruction &compare, const DecodedInstruction &branch);
+
+        // ADD, SUB, MUL and CMP on a value of the first register the caller already holds, the first
+        // three return what they wrote back to it. The flags are left alone when nothing can read them.
+        uint64_t addRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags);
+        uint64_t subRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags);
+        uint64_t mulRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags);
+        void compareRegisters(const DecodedInstruction &instruction, uint64_t left, bool flags);
+
+        void setFlags(FlagSource source, uint64_t left, uint64_t right, uint64_t result)
+        {
+            flagSource = source;
+            flagLeft = left;
+            flagRight = right;
+            flagResult = result;
+        }
+        uint16_t computeFlags() const;
+        void materializeFlags(); // Brings fr up to date, for code that reads it directly
         bool isFlagSet(Flag flag) const;
 
+        friend class Jit;
+
     public:
         CPU();
+        CPU(std::shared_ptr<Bus> bus, uint64_t id);
         void run();
         void step();
         void halt();
+        void requestHalt();
+        void start(uint64_t address, uint64_t stack);
+        uint64_t getId() const;
+
+        // Core running on the calling thread, nullptr outside of run()
+        static CPU *getCurrent();
+        void setEngine(Engine engine);
+        Engine getEngine() const;
+        void setClockFrequency(uint64_t frequency);
+        uint64_t getClockFrequency() const;
+        uint64_t getCycles() const;
+        Scheduler &getScheduler();
+        CoreCounters &getCounters();
+        void setTracer(TraceWriter *tracer);
+        void setProfiler(Profiler *profiler);
+        bool saveSnapshot(const std::string &path, SnapshotKind kind = SnapshotKind::Full);
+        bool loadSnapshot(const std::string &path);
 
         std::shared_ptr<Bus> &getBus();
         void setRegister(size_t index, uint64_t value);
         uint64_t getRegister(size_t index) const;
+        uint16_t getFlags() const;
         void dumpState() const;
     };
 }
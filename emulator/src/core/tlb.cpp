@@ -0,0 +1,26 @@
+#include <core/tlb.hpp>
+#include <spdlog/spdlog.h>
+
+namespace sx64
+{
+    // Page numbers never reach this, so it marks an empty entry
+    static constexpr uint64_t invalidPage = UINT64_MAX;
+
+    Tlb::Tlb()
+    {
+        flush();
+    }
+
+    void Tlb::flush()
+    {
+        readEntries.fill(Entry{invalidPage, nullptr});
+        writeEntries.fill(Entry{invalidPage, nullptr});
+    }
+
+    void Tlb::fill(const Bus &bus, Entry &entry, uint64_t page, bool write)
+    {
+        entry.page = page;
+        entry.host = bus.translate(page << SX64_PAGE_SHIFT, write);
+        SPDLOG_TRACE("TLB {} fill for page {:#x}: {}", write ? "write" : "read", page, entry.host ? "host" : "bus");
+    }
+}
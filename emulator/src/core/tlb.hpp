@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <core/bus.hpp>
+
+#define SX64_TLB_ENTRIES 256
+
+namespace sx64
+{
+    // Direct-mapped cache of guest pages to the host memory backing them. Pages the
+    // bus cannot hand out are cached too, with a null host pointer, so MMIO misses stay cheap.
+    class Tlb
+    {
+    public:
+        Tlb();
+
+        // Host address for a guest address, or nullptr when the access has to go through the bus
+        uint8_t *translate(const Bus &bus, uint64_t address, bool write)
+        {
+            uint64_t page = address >> SX64_PAGE_SHIFT;
+            Entry &entry = (write ? writeEntries : readEntries)[page & (SX64_TLB_ENTRIES - 1)];
+            if (entry.page != page)
+            {
+                fill(bus, entry, page, write);
+            }
+            return entry.host ? entry.host + (address & (SX64_PAGE_SIZE - 1)) : nullptr;
+        }
+
+        void flush();
+
+    private:
+        struct Entry
+        {
+            uint64_t page;
+            uint8_t *host;
+        };
+
+        void fill(const Bus &bus, Entry &entry, uint64_t page, bool write);
+
+        std::array<Entry, SX64_TLB_ENTRIES> readEntries;
+        std::array<Entry, SX64_TLB_ENTRIES> writeEntries;
+    };
+}
@@ -0,0 +1,100 @@
+#include <core/trace.hpp>
+#include <spdlog/spdlog.h>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <chrono>
+
+namespace sx64
+{
+    TraceWriter::TraceWriter()
+        : ring(std::make_unique<SpscRing<TraceRecord, SX64_TRACE_RING_RECORDS>>()), file(nullptr), stopping(false), stalls(0)
+    {
+    }
+
+    TraceWriter::~TraceWriter()
+    {
+        close();
+    }
+
+    bool TraceWriter::open(const std::string &path)
+    {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            spdlog::error("Could not open trace file \"{}\": {}", path, std::strerror(errno));
+            return false;
+        }
+
+        TraceFileHeader header{};
+        std::memcpy(header.magic, SX64_TRACE_MAGIC, sizeof(SX64_TRACE_MAGIC));
+        header.version = SX64_TRACE_VERSION;
+        header.recordSize = sizeof(TraceRecord);
+        std::fwrite(&header, sizeof(header), 1, file);
+
+        stopping = false;
+        worker = std::thread(&TraceWriter::drain, this);
+        spdlog::debug("Tracing to \"{}\"", path);
+        return true;
+    }
+
+    void TraceWriter::close()
+    {
+        if (!file)
+        {
+            return;
+        }
+
+        stopping = true;
+        worker.join();
+        std::fclose(file);
+        file = nullptr;
+
+        if (stalls > 0)
+        {
+            spdlog::debug("Trace writer fell behind {} times", stalls);
+        }
+    }
+
+    void TraceWriter::drain()
+    {
+        std::vector<TraceRecord> batch(SX64_TRACE_DRAIN_BATCH);
+
+        while (true)
+        {
+            // Read the flag first so records pushed before close() are always picked up
+            bool finishing = stopping.load(std::memory_order_acquire);
+            size_t count = ring->popBatch(batch.data(), batch.size());
+
+            if (count > 0)
+            {
+                std::fwrite(batch.data(), sizeof(TraceRecord), count, file);
+            }
+            else if (finishing)
+            {
+                break;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        std::fflush(file);
+    }
+
+    void TraceWriter::waitForSpace(const TraceRecord &record)
+    {
+        // Never drop records, a trace with holes is worse than a slower run
+        ++stalls;
+        while (!ring->tryPush(record))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    uint64_t TraceWriter::getStalls() const
+    {
+        return stalls;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <core/ring.hpp>
+
+#define SX64_TRACE_MAGIC "SX64TRC"
+#define SX64_TRACE_VERSION 2
+#define SX64_TRACE_RING_RECORDS (1 << 16)
+#define SX64_TRACE_DRAIN_BATCH 4096
+
+namespace sx64
+{
+    enum class TraceAccess : uint8_t
+    {
+        None = 0,
+        Read = 1,
+        Write = 2
+    };
+
+    // One executed instruction, written to the trace file as is (little-endian)
+    struct TraceRecord
+    {
+        uint64_t address;   // Guest address of the instruction
+        uint64_t operand;   // Immediate value or absolute address
+        uint64_t busAddress; // Memory touched by the instruction, if any
+        uint64_t data;       // Value read or written at busAddress
+        uint8_t opcode;
+        uint8_t reg1;
+        uint8_t reg2;
+        TraceAccess access;
+        uint8_t size; // Bytes of data accessed, 1 to 8
+        uint8_t reserved[3];
+    };
+    static_assert(sizeof(TraceRecord) == 40, "TraceRecord is part of the trace file format");
+
+    struct TraceFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+    };
+
+    // Collects records from the CPU thread and writes them to a file from a background thread
+    class TraceWriter
+    {
+    public:
+        TraceWriter();
+        ~TraceWriter();
+
+        bool open(const std::string &path);
+        void close();
+
+        void record(const TraceRecord &record)
+        {
+            if (!ring->tryPush(record))
+            {
+                waitForSpace(record);
+            }
+        }
+
+        uint64_t getStalls() const;
+
+    private:
+        void drain();
+        void waitForSpace(const TraceRecord &record);
+
+        std::unique_ptr<SpscRing<TraceRecord, SX64_TRACE_RING_RECORDS>> ring;
+        std::FILE *file;
+        std::thread worker;
+        std::atomic<bool> stopping;
+        uint64_t stalls; // Times the CPU had to wait for the writer
+    };
+}
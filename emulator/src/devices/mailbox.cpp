@@ -0,0 +1,121 @@
+#include <devices/mailbox.hpp>
+#include <core/sx64.hpp>
+#include <spdlog/spdlog.h>
+
+MailboxDevice::MailboxDevice(const std::string &name, uint64_t coreCount, uint64_t baseAddress)
+    : Device(name, false, baseAddress), coreCount(coreCount), slots(coreCount), stopping(false)
+{
+    // The boot core runs from power on
+    slots[0].running = true;
+    spdlog::debug("Initializing MailboxDevice \"{}\" for {} cores", name, coreCount);
+}
+
+uint8_t MailboxDevice::read(uint64_t address) const
+{
+    if (address == SX64_MAILBOX_CORE_ID)
+    {
+        sx64::CPU *core = sx64::CPU::getCurrent();
+        return core ? static_cast<uint8_t>(core->getId()) : 0;
+    }
+
+    if (address == SX64_MAILBOX_CORE_COUNT)
+    {
+        return static_cast<uint8_t>(coreCount);
+    }
+
+    if (address < SX64_MAILBOX_SLOTS || address >= getSize())
+    {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const Slot &slot = slots[(address - SX64_MAILBOX_SLOTS) / SX64_MAILBOX_SLOT_SIZE];
+    uint64_t offset = (address - SX64_MAILBOX_SLOTS) % SX64_MAILBOX_SLOT_SIZE;
+
+    if (offset < SX64_MAILBOX_STACK)
+    {
+        return static_cast<uint8_t>(slot.startAddress >> ((offset - SX64_MAILBOX_START) * 8));
+    }
+    else if (offset < SX64_MAILBOX_CONTROL)
+    {
+        return static_cast<uint8_t>(slot.stack >> ((offset - SX64_MAILBOX_STACK) * 8));
+    }
+    else if (offset == SX64_MAILBOX_CONTROL)
+    {
+        return slot.running || slot.startPending;
+    }
+    return 0;
+}
+
+void MailboxDevice::write(uint64_t address, uint8_t data)
+{
+    if (address < SX64_MAILBOX_SLOTS || address >= getSize())
+    {
+        SPDLOG_DEBUG("Ignoring write to read-only mailbox register {:#x}", address);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t core = (address - SX64_MAILBOX_SLOTS) / SX64_MAILBOX_SLOT_SIZE;
+    uint64_t offset = (address - SX64_MAILBOX_SLOTS) % SX64_MAILBOX_SLOT_SIZE;
+    Slot &slot = slots[core];
+
+    if (offset < SX64_MAILBOX_STACK)
+    {
+        uint64_t shift = (offset - SX64_MAILBOX_START) * 8;
+        slot.startAddress = (slot.startAddress & ~(0xFFULL << shift)) | (static_cast<uint64_t>(data) << shift);
+    }
+    else if (offset < SX64_MAILBOX_CONTROL)
+    {
+        uint64_t shift = (offset - SX64_MAILBOX_STACK) * 8;
+        slot.stack = (slot.stack & ~(0xFFULL << shift)) | (static_cast<uint64_t>(data) << shift);
+    }
+    else if (offset == SX64_MAILBOX_CONTROL)
+    {
+        if (slot.running || slot.startPending)
+        {
+            spdlog::warn("Core {} is already running, ignoring start request", core);
+            return;
+        }
+
+        spdlog::debug("Starting core {} at {:#016x}", core, slot.startAddress);
+        slot.startPending = true;
+        started.notify_all();
+    }
+}
+
+uint64_t MailboxDevice::getSize() const
+{
+    return SX64_MAILBOX_SLOTS + coreCount * SX64_MAILBOX_SLOT_SIZE;
+}
+
+bool MailboxDevice::waitForStart(uint64_t core, uint64_t &address, uint64_t &stack)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    started.wait(lock, [&] { return stopping || slots[core].startPending; });
+
+    if (stopping)
+    {
+        return false;
+    }
+
+    Slot &slot = slots[core];
+    slot.startPending = false;
+    slot.running = true;
+    address = slot.startAddress;
+    stack = slot.stack;
+    return true;
+}
+
+void MailboxDevice::park(uint64_t core)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[core].running = false;
+}
+
+void MailboxDevice::shutdown()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    started.notify_all();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <core/device.hpp>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#define SX64_MAILBOX_CORE_ID 0x00    // Read: index of the core doing the read
+#define SX64_MAILBOX_CORE_COUNT 0x01 // Read: number of cores in the machine
+#define SX64_MAILBOX_SLOTS 0x20      // First per-core slot
+#define SX64_MAILBOX_SLOT_SIZE 0x20
+
+// Offsets within a core's slot
+#define SX64_MAILBOX_START 0x00   // 8 bytes, little-endian: address the core starts at
+#define SX64_MAILBOX_STACK 0x08   // 8 bytes, little-endian: its stack base and pointer
+#define SX64_MAILBOX_CONTROL 0x10 // Write: start the core. Read: 1 while it runs or is about to.
+
+// Startup handshake for secondary cores. They sit parked until another core fills in their
+// slot and writes its control byte, and park again when they halt.
+class MailboxDevice : public Device
+{
+public:
+    MailboxDevice(const std::string &name, uint64_t coreCount, uint64_t baseAddress);
+
+    uint8_t read(uint64_t address) const override;
+    void write(uint64_t address, uint8_t data) override;
+    uint64_t getSize() const override;
+
+    // Called by a secondary core's thread. Blocks until the core is started and returns where,
+    // false once the machine shuts down.
+    bool waitForStart(uint64_t core, uint64_t &address, uint64_t &stack);
+    void park(uint64_t core);
+    void shutdown();
+
+private:
+    struct Slot
+    {
+        uint64_t startAddress = 0;
+        uint64_t stack = 0;
+        bool startPending = false;
+        bool running = false;
+    };
+
+    uint64_t coreCount;
+    std::vector<Slot> slots;
+    mutable std::mutex mutex;
+    std::condition_variable started;
+    bool stopping;
+};
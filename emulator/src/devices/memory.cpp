@@ -1,24 +1,102 @@
 #include <devices/memory.hpp>
+#include <core/bus.hpp>
+#include <core/snapshot.hpp>
 #include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <cstring>
-#include <vector>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
 
-MemoryDevice::MemoryDevice(const std::string &name, uint64_t size, bool readOnly, uint64_t baseAddress)
-    : Device(name, readOnly, baseAddress), memory(size, 0), size(size)
+MemoryDevice::MemoryDevice(const std::string &name, uint64_t size, bool readOnly, uint64_t baseAddress, HugePages hugePages)
+    : Device(name, readOnly, baseAddress), memory(nullptr), size(size), mappedSize(0), dirtyPages((((size + SX64_PAGE_SIZE - 1) >> SX64_PAGE_SHIFT) + 63) / 64, 0),
+      fileMappedLength(0), transparentHugePages(hugePages == HugePages::Transparent)
 {
+    if (size > 0)
+    {
+        uint64_t pageSize = hugePages == HugePages::None ? static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : SX64_HUGE_PAGE_SIZE;
+        mappedSize = (size + pageSize - 1) & ~(pageSize - 1);
+
+        void *mapping = MAP_FAILED;
+        if (hugePages == HugePages::HugeTlb)
+        {
+            // Reserved up front, without the reservation a short pool only shows up as SIGBUS on first touch
+            mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mapping == MAP_FAILED)
+            {
+                spdlog::warn("No huge pages available for MemoryDevice \"{}\" ({}), using regular pages", name, std::strerror(errno));
+            }
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            throw std::runtime_error("Could not map " + std::to_string(size) + " bytes for MemoryDevice \"" + name + "\": " + std::strerror(errno));
+        }
+
+        memory = static_cast<uint8_t *>(mapping);
+
+        if (hugePages == HugePages::Transparent && madvise(memory, mappedSize, MADV_HUGEPAGE) != 0)
+        {
+            spdlog::warn("Transparent huge pages unavailable for MemoryDevice \"{}\" ({})", name, std::strerror(errno));
+        }
+    }
+
     spdlog::trace("MemoryDevice \"{}\" created with size {:#x} bytes", name, size);
 }
 
+MemoryDevice::~MemoryDevice()
+{
+    if (memory)
+    {
+        munmap(memory, mappedSize);
+    }
+}
+
+void MemoryDevice::discard()
+{
+    markDirty(0, size);
+
+    // Dropping the pages hands them back to the kernel, the next touch maps in fresh zero pages.
+    // A file mapped over the start would come back from the page cache instead, so it is replaced
+    // with anonymous memory first: reset memory reads as zero, images included.
+    if (fileMappedLength)
+    {
+        if (mmap(memory, fileMappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED)
+        {
+            std::memset(memory, 0, size);
+            return;
+        }
+        if (transparentHugePages)
+        {
+            madvise(memory, fileMappedLength, MADV_HUGEPAGE);
+        }
+        fileMappedLength = 0;
+    }
+
+    if (memory && madvise(memory, mappedSize, MADV_DONTNEED) != 0)
+    {
+        std::memset(memory, 0, size);
+    }
+}
+
 void MemoryDevice::initialize()
 {
     Device::initialize();
-    std::fill(memory.begin(), memory.end(), 0);
+    discard();
 }
 
 void MemoryDevice::reset()
 {
     Device::reset();
-    std::fill(memory.begin(), memory.end(), 0);
+    discard();
 }
 
 void MemoryDevice::update()
@@ -41,6 +119,7 @@ void MemoryDevice::write(uint64_t address, uint8_t data)
     if (!isReadOnly() && address < size)
     {
         memory[address] = data;
+        markDirty(address, 1);
     }
     else
     {
@@ -48,6 +127,143 @@ void MemoryDevice::write(uint64_t address, uint8_t data)
     }
 }
 
+// Guest memory is little-endian, as are the hosts we run on, so wide accesses are plain copies
+bool MemoryDevice::inBounds(uint64_t address, uint64_t length) const
+{
+    return address <= size && length <= size - address;
+}
+
+bool MemoryDevice::load(uint64_t address, void *buffer, uint64_t length) const
+{
+    if (!inBounds(address, length))
+    {
+        return false;
+    }
+    std::memcpy(buffer, memory + address, length);
+    return true;
+}
+
+bool MemoryDevice::store(uint64_t address, const void *buffer, uint64_t length)
+{
+    if (isReadOnly() || !inBounds(address, length))
+    {
+        return false;
+    }
+    std::memcpy(memory + address, buffer, length);
+    markDirty(address, length);
+    return true;
+}
+
+uint16_t MemoryDevice::read16(uint64_t address) const
+{
+    uint16_t data;
+    return load(address, &data, sizeof(data)) ? data : Device::read16(address);
+}
+
+uint32_t MemoryDevice::read32(uint64_t address) const
+{
+    uint32_t data;
+    return load(address, &data, sizeof(data)) ? data : Device::read32(address);
+}
+
+uint64_t MemoryDevice::read64(uint64_t address) const
+{
+    uint64_t data;
+    return load(address, &data, sizeof(data)) ? data : Device::read64(address);
+}
+
+void MemoryDevice::write16(uint64_t address, uint16_t data)
+{
+    if (!store(address, &data, sizeof(data)))
+    {
+        Device::write16(address, data);
+    }
+}
+
+void MemoryDevice::write32(uint64_t address, uint32_t data)
+{
+    if (!store(address, &data, sizeof(data)))
+    {
+        Device::write32(address, data);
+    }
+}
+
+void MemoryDevice::write64(uint64_t address, uint64_t data)
+{
+    if (!store(address, &data, sizeof(data)))
+    {
+        Device::write64(address, data);
+    }
+}
+
+void MemoryDevice::readBlock(uint64_t address, uint8_t *buffer, uint64_t size) const
+{
+    if (!load(address, buffer, size))
+    {
+        Device::readBlock(address, buffer, size);
+    }
+}
+
+void MemoryDevice::writeBlock(uint64_t address, const uint8_t *buffer, uint64_t size)
+{
+    if (!store(address, buffer, size))
+    {
+        Device::writeBlock(address, buffer, size);
+    }
+}
+
+uint8_t *MemoryDevice::getHostPointer(uint64_t address, bool write)
+{
+    if ((write && isReadOnly()) || address >= size)
+    {
+        return nullptr;
+    }
+
+    if (write)
+    {
+        markDirty(address, 1);
+    }
+    return memory + address;
+}
+
+uint64_t *MemoryDevice::getDirtyBitmap()
+{
+    return dirtyPages.data();
+}
+
+void MemoryDevice::markDirty(uint64_t address, uint64_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    for (uint64_t page = address >> SX64_PAGE_SHIFT; page <= (address + length - 1) >> SX64_PAGE_SHIFT; ++page)
+    {
+        // Cores fill their TLBs concurrently, an atomic OR keeps one from losing another's bit
+        uint64_t bit = 1ULL << (page % 64);
+        if (!(__atomic_load_n(&dirtyPages[page / 64], __ATOMIC_RELAXED) & bit))
+        {
+            __atomic_fetch_or(&dirtyPages[page / 64], bit, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+uint64_t MemoryDevice::countDirtyPages() const
+{
+    uint64_t count = 0;
+    for (uint64_t word : dirtyPages)
+    {
+        count += static_cast<uint64_t>(__builtin_popcountll(word));
+    }
+    return count;
+}
+
+void MemoryDevice::checkpoint()
+{
+    std::fill(dirtyPages.begin(), dirtyPages.end(), 0);
+}
+
 uint64_t MemoryDevice::getSize() const
 {
     return size;
@@ -55,11 +271,11 @@ uint64_t MemoryDevice::getSize() const
 
 void MemoryDevice::initializeWithBuffer(const uint8_t *initBuffer, size_t bufferSize)
 {
-    std::fill(memory.begin(), memory.end(), 0);
+    discard();
     if (initBuffer && bufferSize > 0)
     {
         size_t bytesToCopy = std::min(bufferSize, size);
-        std::memcpy(memory.data(), initBuffer, bytesToCopy);
+        std::memcpy(memory, initBuffer, bytesToCopy);
         spdlog::trace("MemoryDevice \"{}\" initialized with {} bytes from buffer", getName(), bytesToCopy);
     }
     else
@@ -67,3 +283,192 @@ void MemoryDevice::initializeWithBuffer(const uint8_t *initBuffer, size_t buffer
         spdlog::warn("MemoryDevice \"{}\" initialization buffer is null or buffer size is zero", getName());
     }
 }
+
+bool MemoryDevice::loadImage(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        spdlog::error("Could not open image \"{}\": {}", path, std::strerror(errno));
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        spdlog::error("Could not stat image \"{}\": {}", path, std::strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    uint64_t imageSize = static_cast<uint64_t>(info.st_size);
+    uint64_t bytes = std::min(imageSize, size);
+    if (imageSize > size)
+    {
+        spdlog::warn("Image \"{}\" is {} bytes, only the first {} fit in MemoryDevice \"{}\"", path, imageSize, size, getName());
+    }
+
+    discard();
+    bool loaded = mapFile(fd, 0, bytes, path);
+    close(fd);
+
+    if (loaded)
+    {
+        spdlog::trace("MemoryDevice \"{}\" loaded {} bytes from image \"{}\"", getName(), bytes, path);
+    }
+    return loaded;
+}
+
+bool MemoryDevice::mapFile(int fd, uint64_t offset, uint64_t bytes, const std::string &path)
+{
+    // Map the file privately over the start of the backing store: pages come from the page cache,
+    // shared until the guest writes them, and the tail past the file contents stays anonymous zero memory.
+    // Unreserved like the anonymous backing, or files larger than host memory could not be mapped at all.
+    uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t mapLength = (bytes + pageSize - 1) & ~(pageSize - 1);
+    if (bytes == 0)
+    {
+        return true;
+    }
+    if (mmap(memory, mapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, fd, static_cast<off_t>(offset)) != MAP_FAILED)
+    {
+        fileMappedLength = std::max(fileMappedLength, mapLength);
+        return true;
+    }
+
+    // Huge page backings cannot take a file mapping, copy instead
+    spdlog::debug("Could not map \"{}\" ({}), copying it", path, std::strerror(errno));
+    uint64_t copied = 0;
+    while (copied < bytes)
+    {
+        ssize_t result = pread(fd, memory + copied, bytes - copied, static_cast<off_t>(offset + copied));
+        if (result <= 0)
+        {
+            spdlog::error("Could not read \"{}\": {}", path, result < 0 ? std::strerror(errno) : "unexpected end of file");
+            return false;
+        }
+        copied += static_cast<uint64_t>(result);
+    }
+    return true;
+}
+
+bool MemoryDevice::saveState(sx64::SnapshotWriter &writer) const
+{
+    if (!writer.write(size) || !writer.align())
+    {
+        return false;
+    }
+
+    // Zero pages become holes, so untouched RAM takes no space in the snapshot
+    uint64_t pageSize = SX64_PAGE_SIZE;
+    uint64_t runStart = 0;
+    for (uint64_t page = 0; page < size; page += pageSize)
+    {
+        uint64_t length = std::min(pageSize, size - page);
+        if (memory[page] == 0 && std::memcmp(memory + page, memory + page + 1, length - 1) == 0)
+        {
+            if (!writer.write(memory + runStart, page - runStart) || !writer.skip(length))
+            {
+                return false;
+            }
+            runStart = page + length;
+        }
+    }
+    return writer.write(memory + runStart, size - runStart);
+}
+
+bool MemoryDevice::loadState(sx64::SnapshotReader &reader)
+{
+    uint64_t savedSize;
+    if (!reader.read(savedSize))
+    {
+        return false;
+    }
+
+    if (savedSize != size)
+    {
+        spdlog::error("Snapshot holds {} bytes for MemoryDevice \"{}\", which has {}", savedSize, getName(), size);
+        return false;
+    }
+
+    if (!reader.align())
+    {
+        return false;
+    }
+
+    uint64_t offset = reader.getOffset();
+    if (!reader.skip(size))
+    {
+        return false;
+    }
+
+    // Mapped rather than read, restoring costs page faults on first touch instead of a copy up front
+    discard();
+    return mapFile(reader.getFd(), offset, size, reader.getPath());
+}
+
+// Calls function(offset, length) for each run of consecutive pages set in bitmap, stopping when it fails
+template <typename Function>
+static bool forEachDirtyRun(const std::vector<uint64_t> &bitmap, uint64_t size, Function function)
+{
+    uint64_t runStart = 0;
+    uint64_t runEnd = 0;
+    for (uint64_t index = 0; index < bitmap.size(); ++index)
+    {
+        uint64_t bits = bitmap[index];
+        while (bits)
+        {
+            uint64_t offset = (index * 64 + static_cast<uint64_t>(__builtin_ctzll(bits))) << SX64_PAGE_SHIFT;
+            bits &= bits - 1;
+
+            if (offset != runEnd)
+            {
+                if (runEnd > runStart && !function(runStart, runEnd - runStart))
+                {
+                    return false;
+                }
+                runStart = offset;
+            }
+            runEnd = std::min<uint64_t>(offset + SX64_PAGE_SIZE, size);
+        }
+    }
+    return runEnd <= runStart || function(runStart, runEnd - runStart);
+}
+
+bool MemoryDevice::saveDelta(sx64::SnapshotWriter &writer) const
+{
+    if (!writer.write(size) || !writer.write(dirtyPages.data(), dirtyPages.size() * sizeof(uint64_t)) || !writer.align())
+    {
+        return false;
+    }
+
+    // Only the pages written since the last checkpoint, packed in page order
+    spdlog::debug("MemoryDevice \"{}\" saving {} written pages", getName(), countDirtyPages());
+    return forEachDirtyRun(dirtyPages, size, [&](uint64_t offset, uint64_t length)
+                           { return writer.write(memory + offset, length); });
+}
+
+bool MemoryDevice::loadDelta(sx64::SnapshotReader &reader)
+{
+    uint64_t savedSize;
+    if (!reader.read(savedSize))
+    {
+        return false;
+    }
+
+    if (savedSize != size)
+    {
+        spdlog::error("Snapshot holds {} bytes for MemoryDevice \"{}\", which has {}", savedSize, getName(), size);
+        return false;
+    }
+
+    std::vector<uint64_t> written(dirtyPages.size());
+    if (!reader.read(written.data(), written.size() * sizeof(uint64_t)) || !reader.align())
+    {
+        return false;
+    }
+
+    // Copied rather than mapped, a page-sized mapping each would run into the host's mapping limit
+    return forEachDirtyRun(written, size, [&](uint64_t offset, uint64_t length)
+                           { return reader.read(memory + offset, length); });
+}
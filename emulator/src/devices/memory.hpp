@@ -4,20 +4,61 @@
 #include <vector>
 #include <core/device.hpp>
 
+#define SX64_HUGE_PAGE_SIZE (2ULL * 1024 * 1024)
+
 class MemoryDevice : public Device
 {
 public:
-    MemoryDevice(const std::string &name, uint64_t size, bool readOnly, uint64_t baseAddress = 0);
+    enum class HugePages
+    {
+        None,        // Regular pages
+        Transparent, // Ask the kernel for transparent huge pages
+        HugeTlb      // Reserved hugetlbfs pages, falls back to regular pages when none are free
+    };
+
+    MemoryDevice(const std::string &name, uint64_t size, bool readOnly, uint64_t baseAddress = 0, HugePages hugePages = HugePages::None);
+    ~MemoryDevice() override;
+    MemoryDevice(const MemoryDevice &) = delete;
+    MemoryDevice &operator=(const MemoryDevice &) = delete;
 
     void initialize() override;
     void reset() override;
     void update() override;
     uint8_t read(uint64_t address) const override;
     void write(uint64_t address, uint8_t data) override;
+    uint16_t read16(uint64_t address) const override;
+    uint32_t read32(uint64_t address) const override;
+    uint64_t read64(uint64_t address) const override;
+    void write16(uint64_t address, uint16_t data) override;
+    void write32(uint64_t address, uint32_t data) override;
+    void write64(uint64_t address, uint64_t data) override;
+    void readBlock(uint64_t address, uint8_t *buffer, uint64_t size) const override;
+    void writeBlock(uint64_t address, const uint8_t *buffer, uint64_t size) override;
+    uint8_t *getHostPointer(uint64_t address, bool write) override;
     uint64_t getSize() const override;
     void initializeWithBuffer(const uint8_t *buffer, uint64_t size);
+    bool loadImage(const std::string &path);
+    uint64_t *getDirtyBitmap() override;
+    bool saveState(sx64::SnapshotWriter &writer) const override;
+    bool loadState(sx64::SnapshotReader &reader) override;
+    bool saveDelta(sx64::SnapshotWriter &writer) const override;
+    bool loadDelta(sx64::SnapshotReader &reader) override;
+    void checkpoint() override;
+    uint64_t countDirtyPages() const;
 
 private:
-    std::vector<uint8_t> memory;
+    bool inBounds(uint64_t address, uint64_t length) const;
+    bool load(uint64_t address, void *buffer, uint64_t length) const;
+    bool store(uint64_t address, const void *buffer, uint64_t length);
+    void discard();
+    bool mapFile(int fd, uint64_t offset, uint64_t bytes, const std::string &path);
+    void markDirty(uint64_t address, uint64_t length);
+
+    // Anonymous mapping, pages are committed on first touch and read as zero until then
+    uint8_t *memory;
     uint64_t size;
+    uint64_t mappedSize;
+    std::vector<uint64_t> dirtyPages; // Pages written since the last checkpoint, one bit each
+    uint64_t fileMappedLength;        // Bytes at the start of memory mapped from an image or snapshot
+    bool transparentHugePages;
 };
@@ -1,159 +1,114 @@
 #include <devices/serial.hpp>
+#include <devices/serial_stream.hpp>
+#ifndef SX64_HEADLESS
+#include <devices/serial_sdl.hpp>
+#endif
+#include <core/snapshot.hpp>
 #include <spdlog/spdlog.h>
-#include <global.hpp>
-#include <stdexcept>
-#include <iostream>
-#include <sstream>
 
-SerialDevice::SerialDevice(const std::string &name, uint64_t width, uint64_t height, uint64_t baseAddress)
-    : Device(name, false, baseAddress), window(nullptr), renderer(nullptr), font(nullptr), textColor{255, 255, 255, 255}, width(width), height(height)
+void SerialBackend::initialize()
 {
-    spdlog::debug("Initializing SerialDevice with width: {} and height: {}", width, height);
-    size = 1;
 }
 
-SerialDevice::~SerialDevice()
+void SerialBackend::update()
 {
-    spdlog::trace("Destroying SerialDevice resources");
+}
 
-    std::string userInput;
-    spdlog::info("The CPU finished executing. Press Enter to quit the serial monitor...");
-    std::getline(std::cin, userInput);
+std::string SerialBackend::getHistory() const
+{
+    return {};
+}
 
-    if (font)
-    {
-        TTF_CloseFont(font);
-        spdlog::debug("Serial: Font closed");
-    }
-    if (renderer)
-    {
-        SDL_DestroyRenderer(renderer);
-        spdlog::debug("Serial: Renderer destroyed");
-    }
-    if (window)
-    {
-        SDL_DestroyWindow(window);
-        spdlog::debug("Serial: Window destroyed");
-    }
-    TTF_Quit();
-    SDL_Quit();
+void SerialBackend::restoreHistory([[maybe_unused]] const std::string &history)
+{
 }
 
-void SerialDevice::initialize()
+void SerialBackend::setCloseHandler(std::function<void()> handler)
 {
-    spdlog::trace("Starting SDL and TTF initialization");
+    closeHandler = std::move(handler);
+}
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0)
-    {
-        throw std::runtime_error("SDL could not initialize! SDL_Error: " + std::string(SDL_GetError()));
-    }
+std::string BufferSerialBackend::getHistory() const
+{
+    return output;
+}
 
-    if (TTF_Init() == -1)
+void BufferSerialBackend::restoreHistory(const std::string &history)
+{
+    output = history;
+}
+
+const std::string &BufferSerialBackend::getOutput() const
+{
+    return output;
+}
+
+std::unique_ptr<SerialBackend> createSerialBackend(const std::string &spec)
+{
+    if (spec == "sdl")
     {
-        throw std::runtime_error("SDL_ttf could not initialize! TTF_Error: " + std::string(TTF_GetError()));
+#ifndef SX64_HEADLESS
+        return std::make_unique<SdlSerialBackend>(800, 600);
+#else
+        spdlog::error("This build has no SDL serial monitor, use --serial=stdio, file:<path> or pty");
+        return nullptr;
+#endif
     }
-
-    window = SDL_CreateWindow("sx64 Serial", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
-    if (!window)
+    else if (spec == "stdio")
     {
-        throw std::runtime_error("Window could not be created! SDL_Error: " + std::string(SDL_GetError()));
+        return StreamSerialBackend::openStdout();
     }
-
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer)
+    else if (spec.rfind("file:", 0) == 0 && spec.size() > 5)
     {
-        throw std::runtime_error("Renderer could not be created! SDL_Error: " + std::string(SDL_GetError()));
+        return StreamSerialBackend::openFile(spec.substr(5));
     }
-
-    font = TTF_OpenFont("assets/serial-font.ttf", 16);
-    if (!font)
+    else if (spec == "pty")
     {
-        throw std::runtime_error("Failed to load font! TTF_Error: " + std::string(TTF_GetError()));
+        return StreamSerialBackend::openPty();
     }
 
-    spdlog::trace("SDL and TTF initialized successfully");
-    update();
+    spdlog::error("Unknown serial backend: \"{}\"", spec);
+    return nullptr;
 }
 
-void SerialDevice::update()
+SerialDevice::SerialDevice(const std::string &name, std::unique_ptr<SerialBackend> backend, uint64_t baseAddress)
+    : Device(name, false, baseAddress), backend(std::move(backend)), size(1)
 {
-    spdlog::trace("Updating SerialDevice display");
-
-    SDL_Event event;
-    while (SDL_PollEvent(&event))
-    {
-        if (event.type == SDL_QUIT)
-        {
-            spdlog::info("Window close event detected");
-            g_cpu.halt();
-        }
-    }
-
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-
-    SDL_Color color = textColor;
-    int x = 0, y = 0;
+    spdlog::debug("Initializing SerialDevice \"{}\"", name);
+}
 
-    std::istringstream textStream(textBuffer);
-    std::string line;
-    while (std::getline(textStream, line))
-    {
-        SDL_Surface *surface = TTF_RenderText_Blended(font, line.c_str(), color);
-        if (!surface)
-        {
-            throw std::runtime_error("Unable to create text surface: " + std::string(TTF_GetError()));
-        }
-
-        SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-        if (!texture)
-        {
-            SDL_FreeSurface(surface);
-            throw std::runtime_error("Unable to create text texture: " + std::string(SDL_GetError()));
-        }
-
-        SDL_Rect destRect = {x, y, surface->w, surface->h};
-        SDL_RenderCopy(renderer, texture, nullptr, &destRect);
-
-        SDL_DestroyTexture(texture);
-        SDL_FreeSurface(surface);
-
-        x += surface->w;
-
-        if (static_cast<uint64_t>(x) + surface->w > width)
-        {
-            x = 0;
-            y += surface->h;
-        }
-
-        if (static_cast<uint64_t>(y) + surface->h > height)
-        {
-            y -= surface->h;
-        }
-    }
+void SerialDevice::initialize()
+{
+    backend->initialize();
+}
 
-    SDL_RenderPresent(renderer);
-    spdlog::trace("Display updated");
+void SerialDevice::update()
+{
+    backend->update();
 }
 
-void SerialDevice::write(uint64_t address, uint8_t data)
+void SerialDevice::write([[maybe_unused]] uint64_t address, uint8_t data)
 {
-    spdlog::debug("Writing data: {} at address: {}", data, address);
+    SPDLOG_DEBUG("Writing data: {} at address: {}", data, address);
+    std::lock_guard<std::mutex> lock(writeMutex);
+    backend->write(data);
+}
 
-    addressMap[address] = data;
+bool SerialDevice::saveState(sx64::SnapshotWriter &writer) const
+{
+    return writer.writeString(backend->getHistory());
+}
 
-    char c = static_cast<char>(data);
-    if (std::isprint(c))
-    {
-        textBuffer += c;
-        spdlog::trace("Added character: {}", c);
-    }
-    else if (c == '\n')
+bool SerialDevice::loadState(sx64::SnapshotReader &reader)
+{
+    std::string history;
+    if (!reader.readString(history))
     {
-        textBuffer += '\n';
+        return false;
     }
 
-    update();
+    backend->restoreHistory(history);
+    return true;
 }
 
 uint64_t SerialDevice::getSize() const
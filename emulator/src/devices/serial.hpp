@@ -1,32 +1,67 @@
 #pragma once
 
 #include <core/device.hpp>
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_ttf.h>
 #include <string>
-#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <mutex>
+
+// Where the bytes written to the serial port end up
+class SerialBackend
+{
+public:
+    virtual ~SerialBackend() = default;
+
+    virtual void initialize();
+    virtual void update();
+    virtual void write(uint8_t data) = 0;
+
+    // Text kept for machine snapshots. Backends that hand output straight to the host keep none.
+    virtual std::string getHistory() const;
+    virtual void restoreHistory(const std::string &history);
+
+    // Called, possibly from another thread, when the user closes the output (e.g. the monitor window)
+    void setCloseHandler(std::function<void()> handler);
+
+protected:
+    std::function<void()> closeHandler;
+};
+
+// Keeps all output in memory, for runs whose output is checked rather than watched
+class BufferSerialBackend : public SerialBackend
+{
+public:
+    void write(uint8_t data) override
+    {
+        output.push_back(static_cast<char>(data));
+    }
+
+    std::string getHistory() const override;
+    void restoreHistory(const std::string &history) override;
+    const std::string &getOutput() const;
+
+private:
+    std::string output;
+};
+
+// Backend for a --serial specification: sdl, stdio, file:<path> or pty. nullptr when it cannot be set up.
+std::unique_ptr<SerialBackend> createSerialBackend(const std::string &spec);
 
 class SerialDevice : public Device
 {
 public:
-    SerialDevice(const std::string &name = "Serial Device", uint64_t width = 800, uint64_t height = 600, uint64_t baseAddress = 0x8000);
-    ~SerialDevice() override;
+    SerialDevice(const std::string &name, std::unique_ptr<SerialBackend> backend, uint64_t baseAddress = 0x8000);
 
     void initialize() override;
     void update() override;
     void write(uint64_t address, uint8_t data) override;
+    bool saveState(sx64::SnapshotWriter &writer) const override;
+    bool loadState(sx64::SnapshotReader &reader) override;
 
     uint64_t getSize() const override;
 
 private:
-    SDL_Window *window;
-    SDL_Renderer *renderer;
-    TTF_Font *font;
-    SDL_Color textColor;
-    std::string textBuffer;
-    uint64_t width;
-    uint64_t height;
+    std::unique_ptr<SerialBackend> backend;
+    std::mutex writeMutex; // Backends take bytes from one core at a time
     uint64_t size;
-
-    std::unordered_map<uint64_t, uint64_t> addressMap;
 };
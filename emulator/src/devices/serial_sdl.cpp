@@ -0,0 +1,470 @@
+#ifndef SX64_HEADLESS
+
+#include <devices/serial_sdl.hpp>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <iostream>
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+SdlSerialBackend::SdlSerialBackend(uint64_t width, uint64_t height)
+    : window(nullptr), renderer(nullptr), font(nullptr), atlas(nullptr), screen(nullptr), textColor{255, 255, 255, 255}, width(width), height(height),
+      cellWidth(0), cellHeight(0), columns(0), rows(0), scrollback(SX64_SERIAL_SCROLLBACK_LINES), totalLines(1), viewOffset(0), redrawAll(true),
+      ring(std::make_unique<sx64::SpscRing<uint8_t, SX64_SERIAL_SDL_RING_BYTES>>()), stopping(false)
+{
+    spdlog::debug("Initializing SDL serial monitor with width: {} and height: {}", width, height);
+}
+
+SdlSerialBackend::~SdlSerialBackend()
+{
+    spdlog::trace("Destroying SDL serial monitor resources");
+
+    if (!presenter.joinable())
+    {
+        return;
+    }
+
+    // The window stays live and responsive until the user is done reading it
+    std::string userInput;
+    spdlog::info("The CPU finished executing. Press Enter to quit the serial monitor...");
+    std::getline(std::cin, userInput);
+
+    stopping.store(true, std::memory_order_release);
+    presenter.join();
+}
+
+void SdlSerialBackend::initialize()
+{
+    // SDL wants the window and its events handled on the thread that created them
+    std::promise<void> ready;
+    std::future<void> started = ready.get_future();
+    presenter = std::thread(&SdlSerialBackend::present, this, &ready);
+
+    try
+    {
+        started.get();
+    }
+    catch (...)
+    {
+        presenter.join();
+        throw;
+    }
+}
+
+void SdlSerialBackend::present(std::promise<void> *ready)
+{
+    using namespace std::chrono;
+
+    try
+    {
+        setup();
+    }
+    catch (...)
+    {
+        cleanup();
+        ready->set_exception(std::current_exception());
+        return;
+    }
+    ready->set_value();
+
+    auto nextFrame = steady_clock::now();
+    while (true)
+    {
+        // Read the flag first so bytes queued before shutdown are always shown
+        bool finishing = stopping.load(std::memory_order_acquire);
+        drain();
+
+        if (finishing || steady_clock::now() >= nextFrame)
+        {
+            handleEvents();
+            render();
+            nextFrame = steady_clock::now() + milliseconds(SX64_SERIAL_FRAME_MS);
+        }
+
+        if (finishing)
+        {
+            break;
+        }
+
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    cleanup();
+}
+
+void SdlSerialBackend::setup()
+{
+    spdlog::trace("Starting SDL and TTF initialization");
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0)
+    {
+        throw std::runtime_error("SDL could not initialize! SDL_Error: " + std::string(SDL_GetError()));
+    }
+
+    if (TTF_Init() == -1)
+    {
+        throw std::runtime_error("SDL_ttf could not initialize! TTF_Error: " + std::string(TTF_GetError()));
+    }
+
+    window = SDL_CreateWindow("sx64 Serial", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
+    if (!window)
+    {
+        throw std::runtime_error("Window could not be created! SDL_Error: " + std::string(SDL_GetError()));
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+    if (!renderer)
+    {
+        throw std::runtime_error("Renderer could not be created! SDL_Error: " + std::string(SDL_GetError()));
+    }
+
+    // Look next to the executable first, so the monitor works from any working directory
+    std::string fontPath = SX64_SERIAL_FONT;
+    if (char *basePath = SDL_GetBasePath())
+    {
+        std::string candidate = std::string(basePath) + SX64_SERIAL_FONT;
+        SDL_free(basePath);
+        if (access(candidate.c_str(), R_OK) == 0)
+        {
+            fontPath = candidate;
+        }
+    }
+
+    font = TTF_OpenFont(fontPath.c_str(), 16);
+    if (!font)
+    {
+        throw std::runtime_error("Failed to load font! TTF_Error: " + std::string(TTF_GetError()));
+    }
+
+    buildAtlas();
+
+    screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+    if (!screen)
+    {
+        throw std::runtime_error("Unable to create screen texture: " + std::string(SDL_GetError()));
+    }
+
+    spdlog::trace("SDL and TTF initialized successfully");
+}
+
+void SdlSerialBackend::cleanup()
+{
+    if (screen)
+    {
+        SDL_DestroyTexture(screen);
+        screen = nullptr;
+    }
+    if (atlas)
+    {
+        SDL_DestroyTexture(atlas);
+        atlas = nullptr;
+    }
+    if (font)
+    {
+        TTF_CloseFont(font);
+        font = nullptr;
+        spdlog::debug("Serial: Font closed");
+    }
+    if (renderer)
+    {
+        SDL_DestroyRenderer(renderer);
+        renderer = nullptr;
+        spdlog::debug("Serial: Renderer destroyed");
+    }
+    if (window)
+    {
+        SDL_DestroyWindow(window);
+        window = nullptr;
+        spdlog::debug("Serial: Window destroyed");
+    }
+    TTF_Quit();
+    SDL_Quit();
+}
+
+void SdlSerialBackend::buildAtlas()
+{
+    // The cell is as wide as the widest glyph, so proportional fonts still line up
+    cellHeight = TTF_FontLineSkip(font);
+    for (int c = SX64_SERIAL_FIRST_GLYPH; c <= SX64_SERIAL_LAST_GLYPH; ++c)
+    {
+        int advance = 0;
+        if (TTF_GlyphMetrics(font, static_cast<Uint16>(c), nullptr, nullptr, nullptr, nullptr, &advance) == 0)
+        {
+            cellWidth = std::max(cellWidth, advance);
+        }
+    }
+
+    if (cellWidth <= 0 || cellHeight <= 0)
+    {
+        throw std::runtime_error("Serial font has no usable glyphs");
+    }
+
+    columns = std::max<uint64_t>(width / cellWidth, 1);
+    rows = std::max<uint64_t>(height / cellHeight, 1);
+    dirtyRows.assign(rows, true);
+
+    int glyphCount = SX64_SERIAL_LAST_GLYPH - SX64_SERIAL_FIRST_GLYPH + 1;
+    SDL_Surface *sheet = SDL_CreateRGBSurfaceWithFormat(0, cellWidth * glyphCount, cellHeight, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!sheet)
+    {
+        throw std::runtime_error("Unable to create glyph atlas: " + std::string(SDL_GetError()));
+    }
+
+    // Glyphs are rendered white once and tinted with the text color when drawn
+    SDL_Color white = {255, 255, 255, 255};
+    for (int i = 0; i < glyphCount; ++i)
+    {
+        SDL_Surface *glyph = TTF_RenderGlyph_Blended(font, static_cast<Uint16>(SX64_SERIAL_FIRST_GLYPH + i), white);
+        if (!glyph)
+        {
+            continue;
+        }
+
+        SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+        SDL_Rect source = {0, 0, std::min(glyph->w, cellWidth), std::min(glyph->h, cellHeight)};
+        SDL_Rect destination = {i * cellWidth, 0, source.w, source.h};
+        SDL_BlitSurface(glyph, &source, sheet, &destination);
+        SDL_FreeSurface(glyph);
+    }
+
+    atlas = SDL_CreateTextureFromSurface(renderer, sheet);
+    SDL_FreeSurface(sheet);
+    if (!atlas)
+    {
+        throw std::runtime_error("Unable to create glyph atlas texture: " + std::string(SDL_GetError()));
+    }
+
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+    SDL_SetTextureColorMod(atlas, textColor.r, textColor.g, textColor.b);
+    spdlog::debug("Serial: {}x{} cells of {}x{} pixels", columns, rows, cellWidth, cellHeight);
+}
+
+void SdlSerialBackend::handleEvents()
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
+    {
+        if (event.type == SDL_QUIT)
+        {
+            spdlog::info("Window close event detected");
+            if (closeHandler)
+            {
+                closeHandler();
+            }
+        }
+        else if (event.type == SDL_MOUSEWHEEL)
+        {
+            std::lock_guard<std::mutex> lock(gridMutex);
+            scroll(static_cast<int64_t>(event.wheel.y) * SX64_SERIAL_WHEEL_LINES);
+        }
+        else if (event.type == SDL_RENDER_TARGETS_RESET || event.type == SDL_RENDER_DEVICE_RESET)
+        {
+            // The screen texture lost its contents
+            std::lock_guard<std::mutex> lock(gridMutex);
+            redrawAll = true;
+        }
+    }
+}
+
+void SdlSerialBackend::render()
+{
+    std::lock_guard<std::mutex> lock(gridMutex);
+
+    if (redrawAll)
+    {
+        std::fill(dirtyRows.begin(), dirtyRows.end(), true);
+        redrawAll = false;
+    }
+
+    SDL_SetRenderTarget(renderer, screen);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+
+    uint64_t first = firstVisibleLine();
+    for (uint64_t row = 0; row < rows; ++row)
+    {
+        if (!dirtyRows[row])
+        {
+            continue;
+        }
+        dirtyRows[row] = false;
+
+        int y = static_cast<int>(row) * cellHeight;
+        SDL_Rect rowRect = {0, y, static_cast<int>(width), cellHeight};
+        SDL_RenderFillRect(renderer, &rowRect);
+
+        if (first + row >= totalLines)
+        {
+            continue;
+        }
+
+        const std::string &text = lineAt(first + row);
+        for (size_t column = 0; column < text.size(); ++column)
+        {
+            SDL_Rect source = {(text[column] - SX64_SERIAL_FIRST_GLYPH) * cellWidth, 0, cellWidth, cellHeight};
+            SDL_Rect destination = {static_cast<int>(column) * cellWidth, y, cellWidth, cellHeight};
+            SDL_RenderCopy(renderer, atlas, &source, &destination);
+        }
+    }
+
+    SDL_SetRenderTarget(renderer, nullptr);
+    SDL_RenderCopy(renderer, screen, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
+
+void SdlSerialBackend::drain()
+{
+    std::array<uint8_t, 4096> batch;
+    std::lock_guard<std::mutex> lock(gridMutex);
+
+    while (size_t count = ring->popBatch(batch.data(), batch.size()))
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            putChar(static_cast<char>(batch[i]));
+        }
+    }
+}
+
+void SdlSerialBackend::waitForSpace(uint8_t data)
+{
+    // The presentation thread is behind, wait for it rather than losing output
+    while (!ring->tryPush(data))
+    {
+        std::this_thread::yield();
+    }
+}
+
+void SdlSerialBackend::waitUntilDrained() const
+{
+    while (presenter.joinable() && !ring->empty())
+    {
+        std::this_thread::yield();
+    }
+}
+
+void SdlSerialBackend::putChar(char c)
+{
+    if (c == '\n')
+    {
+        newLine();
+        return;
+    }
+
+    if (c < SX64_SERIAL_FIRST_GLYPH || c > SX64_SERIAL_LAST_GLYPH)
+    {
+        return;
+    }
+
+    if (columns > 0 && lineAt(totalLines - 1).size() >= columns)
+    {
+        newLine();
+    }
+
+    lineAt(totalLines - 1) += c;
+    markLineDirty(totalLines - 1);
+    SPDLOG_TRACE("Added character: {}", c);
+}
+
+void SdlSerialBackend::newLine()
+{
+    ++totalLines;
+    lineAt(totalLines - 1).clear();
+
+    if (viewOffset > 0)
+    {
+        // Keep a scrolled back view where it is, unless its top just left the scrollback
+        uint64_t offset = std::min(viewOffset + 1, maxViewOffset());
+        redrawAll = redrawAll || offset != viewOffset + 1;
+        viewOffset = offset;
+    }
+    else if (totalLines > rows)
+    {
+        // Everything moves up a row
+        redrawAll = true;
+    }
+    else
+    {
+        markLineDirty(totalLines - 1);
+    }
+}
+
+void SdlSerialBackend::scroll(int64_t lines)
+{
+    int64_t offset = std::clamp<int64_t>(static_cast<int64_t>(viewOffset) + lines, 0, static_cast<int64_t>(maxViewOffset()));
+    if (static_cast<uint64_t>(offset) != viewOffset)
+    {
+        viewOffset = static_cast<uint64_t>(offset);
+        redrawAll = true;
+    }
+}
+
+void SdlSerialBackend::markLineDirty(uint64_t line)
+{
+    uint64_t first = firstVisibleLine();
+    if (line >= first && line - first < rows)
+    {
+        dirtyRows[line - first] = true;
+    }
+}
+
+uint64_t SdlSerialBackend::oldestLine() const
+{
+    return totalLines > SX64_SERIAL_SCROLLBACK_LINES ? totalLines - SX64_SERIAL_SCROLLBACK_LINES : 0;
+}
+
+uint64_t SdlSerialBackend::firstVisibleLine() const
+{
+    uint64_t end = totalLines - viewOffset;
+    return end > rows ? end - rows : 0;
+}
+
+uint64_t SdlSerialBackend::maxViewOffset() const
+{
+    uint64_t kept = totalLines - oldestLine();
+    return kept > rows ? kept - rows : 0;
+}
+
+std::string &SdlSerialBackend::lineAt(uint64_t line)
+{
+    return scrollback[line % SX64_SERIAL_SCROLLBACK_LINES];
+}
+
+std::string SdlSerialBackend::getHistory() const
+{
+    waitUntilDrained();
+    std::lock_guard<std::mutex> lock(gridMutex);
+
+    std::string history;
+    for (uint64_t line = oldestLine(); line < totalLines; ++line)
+    {
+        if (line != oldestLine())
+        {
+            history += '\n';
+        }
+        history += scrollback[line % SX64_SERIAL_SCROLLBACK_LINES];
+    }
+    return history;
+}
+
+void SdlSerialBackend::restoreHistory(const std::string &history)
+{
+    waitUntilDrained();
+    std::lock_guard<std::mutex> lock(gridMutex);
+
+    for (std::string &line : scrollback)
+    {
+        line.clear();
+    }
+    totalLines = 1;
+    viewOffset = 0;
+    redrawAll = true;
+
+    for (char c : history)
+    {
+        putChar(c);
+    }
+}
+
+#endif
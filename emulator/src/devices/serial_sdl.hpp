@@ -0,0 +1,85 @@
+#pragma once
+
+#include <devices/serial.hpp>
+#include <core/ring.hpp>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <future>
+
+#define SX64_SERIAL_FONT "assets/serial-font.ttf"
+#define SX64_SERIAL_SCROLLBACK_LINES 4096
+#define SX64_SERIAL_FRAME_MS 16     // Time between two presented frames
+#define SX64_SERIAL_SDL_RING_BYTES (1 << 16)
+#define SX64_SERIAL_WHEEL_LINES 3   // Lines scrolled per mouse wheel notch
+#define SX64_SERIAL_FIRST_GLYPH ' '
+#define SX64_SERIAL_LAST_GLYPH '~'
+
+// Serial monitor window. Text sits on a fixed grid of character cells drawn from a glyph atlas
+// into a screen texture, where only rows that changed since the last frame are redrawn. The window
+// belongs to a presentation thread, the CPU thread only queues bytes for it.
+class SdlSerialBackend : public SerialBackend
+{
+public:
+    SdlSerialBackend(uint64_t width, uint64_t height);
+    ~SdlSerialBackend() override;
+
+    void initialize() override;
+    void write(uint8_t data) override
+    {
+        if (!ring->tryPush(data))
+        {
+            waitForSpace(data);
+        }
+    }
+    std::string getHistory() const override;
+    void restoreHistory(const std::string &history) override;
+
+private:
+    void present(std::promise<void> *ready);
+    void setup();
+    void cleanup();
+    void handleEvents();
+    void drain();
+    void waitForSpace(uint8_t data);
+    void waitUntilDrained() const;
+    void buildAtlas();
+    void render();
+    void putChar(char c);
+    void newLine();
+    void scroll(int64_t lines);
+    void markLineDirty(uint64_t line);
+    uint64_t oldestLine() const;
+    uint64_t firstVisibleLine() const;
+    uint64_t maxViewOffset() const;
+    std::string &lineAt(uint64_t line);
+
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    TTF_Font *font;
+    SDL_Texture *atlas;  // Printable ASCII glyphs side by side, one cell each
+    SDL_Texture *screen; // Rendered grid, kept between frames
+    SDL_Color textColor;
+    uint64_t width;
+    uint64_t height;
+    int cellWidth;
+    int cellHeight;
+    uint64_t columns;
+    uint64_t rows;
+
+    std::vector<std::string> scrollback; // Ring of the most recent lines
+    uint64_t totalLines;                 // Lines started since power on, the last one is still being written
+    uint64_t viewOffset;                 // Lines the view is scrolled back from the newest
+    std::vector<bool> dirtyRows;
+    bool redrawAll;
+
+    std::unique_ptr<sx64::SpscRing<uint8_t, SX64_SERIAL_SDL_RING_BYTES>> ring;
+    mutable std::mutex gridMutex; // Guards the scrollback and view, popping from the ring happens under it too
+    std::thread presenter;
+    std::atomic<bool> stopping;
+};
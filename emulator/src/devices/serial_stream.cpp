@@ -0,0 +1,152 @@
+#include <devices/serial_stream.hpp>
+#include <spdlog/spdlog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+StreamSerialBackend::StreamSerialBackend(int fd, bool ownsFd, const std::string &description)
+    : ring(std::make_unique<sx64::SpscRing<uint8_t, SX64_SERIAL_RING_BYTES>>()), fd(fd), ownsFd(ownsFd), description(description), stopping(false), dropped(0)
+{
+    worker = std::thread(&StreamSerialBackend::drain, this);
+    spdlog::debug("Serial output goes to {}", description);
+}
+
+StreamSerialBackend::~StreamSerialBackend()
+{
+    stopping = true;
+    worker.join();
+
+    if (ownsFd)
+    {
+        close(fd);
+    }
+
+    if (dropped > 0)
+    {
+        spdlog::debug("Dropped {} serial bytes nobody was reading from {}", dropped, description);
+    }
+}
+
+std::unique_ptr<StreamSerialBackend> StreamSerialBackend::openStdout()
+{
+    return std::make_unique<StreamSerialBackend>(STDOUT_FILENO, false, "stdout");
+}
+
+std::unique_ptr<StreamSerialBackend> StreamSerialBackend::openFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        spdlog::error("Could not open serial output file \"{}\": {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    return std::make_unique<StreamSerialBackend>(fd, true, "\"" + path + "\"");
+}
+
+std::unique_ptr<StreamSerialBackend> StreamSerialBackend::openPty()
+{
+    // Non-blocking, a pty nobody has opened yet must not stall the guest once its buffer fills
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+    {
+        spdlog::error("Could not create a pty for serial output: {}", std::strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    std::string name = ptsname(fd);
+    spdlog::info("Serial output on {}", name);
+    return std::make_unique<StreamSerialBackend>(fd, true, name);
+}
+
+void StreamSerialBackend::drain()
+{
+    using namespace std::chrono;
+
+    std::array<uint8_t, 4096> batch;
+    std::vector<uint8_t> pending; // Start of a line still being written by the guest
+    steady_clock::time_point pendingSince;
+
+    while (true)
+    {
+        // Read the flag first so bytes queued before shutdown are always picked up
+        bool finishing = stopping.load(std::memory_order_acquire);
+        size_t count = ring->popBatch(batch.data(), batch.size());
+
+        if (count > 0)
+        {
+            if (pending.empty())
+            {
+                pendingSince = steady_clock::now();
+            }
+            pending.insert(pending.end(), batch.begin(), batch.begin() + count);
+
+            // Whole lines go out right away, a long line without breaks once it fills a batch
+            auto lineEnd = std::find(pending.rbegin(), pending.rend(), '\n');
+            size_t complete = pending.size() >= batch.size() ? pending.size() : static_cast<size_t>(pending.rend() - lineEnd);
+            if (complete > 0)
+            {
+                output(pending.data(), complete);
+                pending.erase(pending.begin(), pending.begin() + complete);
+                pendingSince = steady_clock::now();
+            }
+            continue;
+        }
+
+        if (!pending.empty() && (finishing || steady_clock::now() - pendingSince >= milliseconds(SX64_SERIAL_FLUSH_MS)))
+        {
+            output(pending.data(), pending.size());
+            pending.clear();
+        }
+
+        if (finishing)
+        {
+            break;
+        }
+
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+}
+
+void StreamSerialBackend::output(const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t result = ::write(fd, data, length);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK && dropped == 0)
+            {
+                spdlog::error("Could not write serial output to {}: {}", description, std::strerror(errno));
+            }
+            dropped += length;
+            return;
+        }
+
+        data += result;
+        length -= static_cast<size_t>(result);
+    }
+}
+
+void StreamSerialBackend::waitForSpace(uint8_t data)
+{
+    // The writer thread is behind, wait for it rather than losing output
+    while (!ring->tryPush(data))
+    {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <devices/serial.hpp>
+#include <core/ring.hpp>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#define SX64_SERIAL_RING_BYTES (1 << 16)
+#define SX64_SERIAL_FLUSH_MS 20 // Longest a partial line waits before it is written anyway
+
+// Serial output to a host file descriptor: stdout, a file or a pty. The CPU thread only queues
+// bytes, a background thread writes them out a line at a time.
+class StreamSerialBackend : public SerialBackend
+{
+public:
+    StreamSerialBackend(int fd, bool ownsFd, const std::string &description);
+    ~StreamSerialBackend() override;
+
+    static std::unique_ptr<StreamSerialBackend> openStdout();
+    static std::unique_ptr<StreamSerialBackend> openFile(const std::string &path);
+    static std::unique_ptr<StreamSerialBackend> openPty();
+
+    void write(uint8_t data) override
+    {
+        if (!ring->tryPush(data))
+        {
+            waitForSpace(data);
+        }
+    }
+
+private:
+    void drain();
+    void waitForSpace(uint8_t data);
+    void output(const uint8_t *data, size_t length);
+
+    std::unique_ptr<sx64::SpscRing<uint8_t, SX64_SERIAL_RING_BYTES>> ring;
+    int fd;
+    bool ownsFd;
+    std::string description;
+    std::thread worker;
+    std::atomic<bool> stopping;
+    uint64_t dropped; // Bytes nobody was reading, pty output is thrown away rather than blocking the guest
+};
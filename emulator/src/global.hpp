@@ -1,6 +0,0 @@
-#pragma once
-
-#include <core/sx64.hpp>
-
-extern sx64::CPU &g_cpu;
-extern uint64_t g_lastAddress;
\ No newline at end of file
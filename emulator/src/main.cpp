@@ -1,19 +1,25 @@
 #include <iostream>
-#include <fstream>
-#include <vector>
 #include <core/sx64.hpp>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <cctype>
 #include <unordered_map>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <filesystem>
 
-#include <global.hpp>
+#include <core/machine.hpp>
 #include <devices/serial.hpp>
-#include <devices/memory.hpp>
+#include <batch.hpp>
+#include <stats_export.hpp>
 
-sx64::CPU cpu;
-sx64::CPU &g_cpu = cpu;
+#ifndef SX64_HEADLESS
+#define SX64_DEFAULT_SERIAL "sdl"
+#else
+#define SX64_DEFAULT_SERIAL "stdio"
+#endif
 
 const char *program_version = "sx64 Emulator 1.0";
 const char *program_bug_address = "<kevin@alavik.se>";
@@ -28,7 +34,24 @@ void print_help()
               << "  -V, --version            Show version information\n"
               << "  -bi, --boot-image        Specify the system bootstrap image (ROM image)\n"
               << "  -ri, --ram-image         Specify the kernel bootstrap image (RAM image)\n"
-              << "  -rs, --ram-size          Specify RAM size (e.g., 2G, 512M, 1GiB) (default: 32M)\n";
+              << "  -rs, --ram-size          Specify RAM size (e.g., 2G, 512M, 1GiB) (default: 32M)\n"
+              << "  --engine=<name>          Select the execution engine: switch, threaded, jit (default: switch)\n"
+              << "  --clock=<freq>           Emulated clock speed (e.g., 1MHz, 250kHz, 2GHz) or unlimited (default: 1MHz)\n"
+              << "  --cores=<n>              Number of cores, each on its own host thread, or max for one per host core (default: 1)\n"
+              << "  --hugepages=<mode>       Back RAM with huge pages: none, thp, hugetlb (default: none)\n"
+              << "  --serial=<backend>       Serial output: sdl, stdio, file:<path>, pty (default: " SX64_DEFAULT_SERIAL ")\n"
+              << "  --trace <file>           Write a binary trace of every executed instruction (decode with tools/sx64-trace.py)\n"
+              << "  --profile <file>         Sample the guest and write collapsed stacks for flamegraph.pl or speedscope\n"
+              << "  --profile-interval=<n>   Cycles between profile samples (default: " << SX64_PROFILE_DEFAULT_INTERVAL << ")\n"
+              << "  --symbols <file>         Symbol map for the profile, on top of the .map files next to the images\n"
+              << "  --load-snapshot <file>   Restore the machine from a snapshot before running\n"
+              << "  --save-snapshot <file>   Save the machine to a snapshot once the CPU stops\n"
+              << "  --save-delta <file>      Like --save-snapshot, but only what changed since --load-snapshot\n"
+              << "  --stats-socket <path>    Serve performance counters (Prometheus text format) on a Unix socket\n"
+              << "  --stats-file <path>      Rewrite path with the performance counters every second\n"
+              << "  --max-cycles=<n>         Stop the machine after n cycles (default: no limit, " << SX64_BATCH_DEFAULT_BUDGET << " in batch mode)\n"
+              << "  --batch <dir>            Run every <name>.bin in dir as a RAM image and compare its serial output to <name>.expected\n"
+              << "  -j <n>                   Guests run at once in batch mode (default: one per host core)\n";
 }
 
 void print_version()
@@ -81,6 +104,70 @@ size_t parse_ram_size(const std::string &size_str)
     }
 }
 
+uint64_t parse_clock_frequency(const std::string &frequency_str)
+{
+    if (frequency_str == "unlimited")
+    {
+        return 0;
+    }
+
+    std::unordered_map<std::string, uint64_t> multipliers = {
+        {"Hz", 1ULL},
+        {"kHz", 1000ULL},
+        {"KHz", 1000ULL},
+        {"MHz", 1000ULL * 1000},
+        {"GHz", 1000ULL * 1000 * 1000}};
+
+    uint64_t value = 0;
+    size_t i = 0;
+
+    while (i < frequency_str.size() && std::isdigit(frequency_str[i]))
+    {
+        value = value * 10 + (frequency_str[i] - '0');
+        i++;
+    }
+
+    if (i == 0)
+    {
+        throw std::invalid_argument("Missing clock frequency: " + frequency_str);
+    }
+
+    std::string suffix = frequency_str.substr(i);
+    uint64_t frequency = value;
+    if (!suffix.empty())
+    {
+        auto it = multipliers.find(suffix);
+        if (it == multipliers.end())
+        {
+            throw std::invalid_argument("Invalid frequency suffix: " + suffix);
+        }
+        frequency = value * it->second;
+    }
+
+    if (frequency == 0)
+    {
+        throw std::invalid_argument("Clock frequency must be above zero, use \"unlimited\" to run unthrottled");
+    }
+
+    return frequency;
+}
+
+uint64_t parse_core_count(const std::string &count_str)
+{
+    if (count_str == "max")
+    {
+        return std::clamp<uint64_t>(std::thread::hardware_concurrency(), 1, SX64_MAX_CORES);
+    }
+
+    size_t parsed = 0;
+    uint64_t count = std::stoull(count_str, &parsed);
+    if (parsed != count_str.size() || count == 0 || count > SX64_MAX_CORES)
+    {
+        throw std::invalid_argument("Core count must be between 1 and " + std::to_string(SX64_MAX_CORES));
+    }
+    return count;
+}
+
 int main(int argc, char **argv)
 {
     auto file_logger = std::make_shared<spdlog::sinks::basic_file_sink_mt>("logs/sx64.log", true);
@@ -91,9 +178,20 @@ int main(int argc, char **argv)
     logger->set_level(spdlog::level::info);
     spdlog::set_default_logger(logger);
 
-    std::string sys_bootstrap;
-    std::string krnl_bootstrap;
-    size_t ram_size = parse_ram_size("32M");
+    sx64::MachineConfig config;
+    std::string trace_path;
+    std::string profile_path;
+    uint64_t profile_interval = SX64_PROFILE_DEFAULT_INTERVAL;
+    std::vector<std::string> symbol_paths;
+    std::string serial_spec = SX64_DEFAULT_SERIAL;
+    std::string load_snapshot_path;
+    std::string save_snapshot_path;
+    sx64::SnapshotKind save_snapshot_kind = sx64::SnapshotKind::Full;
+    std::string batch_directory;
+    std::string stats_socket_path;
+    std::string stats_file_path;
+    unsigned batch_jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    bool clock_set = false;
 
     spdlog::trace("Starting argument parsing");
 
@@ -125,8 +223,8 @@ int main(int argc, char **argv)
         {
             if (i + 1 < argc)
             {
-                sys_bootstrap = argv[++i];
-                spdlog::debug("System bootstrap image set to: {}", sys_bootstrap);
+                config.bootImage = argv[++i];
+                spdlog::debug("System bootstrap image set to: {}", config.bootImage);
             }
             else
             {
@@ -138,8 +236,8 @@ int main(int argc, char **argv)
         {
             if (i + 1 < argc)
             {
-                krnl_bootstrap = argv[++i];
-                spdlog::debug("Kernel bootstrap image set to: {}", krnl_bootstrap);
+                config.ramImage = argv[++i];
+                spdlog::debug("Kernel bootstrap image set to: {}", config.ramImage);
             }
             else
             {
@@ -153,8 +251,8 @@ int main(int argc, char **argv)
             {
                 try
                 {
-                    ram_size = parse_ram_size(argv[++i]);
-                    spdlog::debug("RAM size set to: {} bytes", ram_size);
+                    config.ramSize = parse_ram_size(argv[++i]);
+                    spdlog::debug("RAM size set to: {} bytes", config.ramSize);
                 }
                 catch (const std::exception &e)
                 {
@@ -168,6 +266,252 @@ int main(int argc, char **argv)
                 return 1;
             }
         }
+        else if (arg.rfind("--engine=", 0) == 0)
+        {
+            std::string engine = arg.substr(std::string("--engine=").size());
+            if (engine == "switch")
+            {
+                config.engine = sx64::Engine::Switch;
+            }
+            else if (engine == "threaded")
+            {
+                config.engine = sx64::Engine::Threaded;
+            }
+            else if (engine == "jit")
+            {
+                config.engine = sx64::Engine::Jit;
+            }
+            else
+            {
+                spdlog::error("Unknown engine: \"{}\"", engine);
+                return 1;
+            }
+            spdlog::debug("Engine set to: {}", engine);
+        }
+        else if (arg == "--trace")
+        {
+            if (i + 1 < argc)
+            {
+                trace_path = argv[++i];
+                spdlog::debug("Trace file set to: {}", trace_path);
+            }
+            else
+            {
+                spdlog::error("--trace option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "--profile")
+        {
+            if (i + 1 < argc)
+            {
+                profile_path = argv[++i];
+                spdlog::debug("Profile file set to: {}", profile_path);
+            }
+            else
+            {
+                spdlog::error("--profile option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg.rfind("--profile-interval=", 0) == 0)
+        {
+            try
+            {
+                profile_interval = std::stoull(arg.substr(std::string("--profile-interval=").size()));
+                if (profile_interval == 0)
+                {
+                    throw std::invalid_argument("interval must be at least one cycle");
+                }
+                spdlog::debug("Profile interval set to: {} cycles", profile_interval);
+            }
+            catch (const std::exception &e)
+            {
+                spdlog::error("Invalid profile interval specified: {}", e.what());
+                return 1;
+            }
+        }
+        else if (arg == "--symbols")
+        {
+            if (i + 1 < argc)
+            {
+                symbol_paths.push_back(argv[++i]);
+                spdlog::debug("Symbol map added: {}", symbol_paths.back());
+            }
+            else
+            {
+                spdlog::error("--symbols option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "--load-snapshot")
+        {
+            if (i + 1 < argc)
+            {
+                load_snapshot_path = argv[++i];
+                spdlog::debug("Snapshot to restore set to: {}", load_snapshot_path);
+            }
+            else
+            {
+                spdlog::error("--load-snapshot option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "--save-snapshot")
+        {
+            if (i + 1 < argc)
+            {
+                save_snapshot_path = argv[++i];
+                save_snapshot_kind = sx64::SnapshotKind::Full;
+                spdlog::debug("Snapshot to save set to: {}", save_snapshot_path);
+            }
+            else
+            {
+                spdlog::error("--save-snapshot option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "--save-delta")
+        {
+            if (i + 1 < argc)
+            {
+                save_snapshot_path = argv[++i];
+                save_snapshot_kind = sx64::SnapshotKind::Delta;
+                spdlog::debug("Delta snapshot to save set to: {}", save_snapshot_path);
+            }
+            else
+            {
+                spdlog::error("--save-delta option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg.rfind("--serial=", 0) == 0)
+        {
+            serial_spec = arg.substr(std::string("--serial=").size());
+            spdlog::debug("Serial backend set to: {}", serial_spec);
+        }
+        else if (arg.rfind("--hugepages=", 0) == 0)
+        {
+            std::string mode = arg.substr(std::string("--hugepages=").size());
+            if (mode == "none")
+            {
+                config.hugePages = MemoryDevice::HugePages::None;
+            }
+            else if (mode == "thp")
+            {
+                config.hugePages = MemoryDevice::HugePages::Transparent;
+            }
+            else if (mode == "hugetlb")
+            {
+                config.hugePages = MemoryDevice::HugePages::HugeTlb;
+            }
+            else
+            {
+                spdlog::error("Unknown huge page mode: \"{}\"", mode);
+                return 1;
+            }
+            spdlog::debug("Huge page mode set to: {}", mode);
+        }
+        else if (arg.rfind("--cores=", 0) == 0)
+        {
+            try
+            {
+                config.coreCount = parse_core_count(arg.substr(std::string("--cores=").size()));
+                spdlog::debug("Core count set to: {}", config.coreCount);
+            }
+            catch (const std::exception &e)
+            {
+                spdlog::error("Invalid core count specified: {}", e.what());
+                return 1;
+            }
+        }
+        else if (arg.rfind("--clock=", 0) == 0)
+        {
+            try
+            {
+                config.clockFrequency = parse_clock_frequency(arg.substr(std::string("--clock=").size()));
+                clock_set = true;
+                spdlog::debug("Clock frequency set to: {} Hz", config.clockFrequency);
+            }
+            catch (const std::exception &e)
+            {
+                spdlog::error("Invalid clock frequency specified: {}", e.what());
+                return 1;
+            }
+        }
+        else if (arg.rfind("--max-cycles=", 0) == 0)
+        {
+            try
+            {
+                config.cycleBudget = std::stoull(arg.substr(std::string("--max-cycles=").size()));
+                spdlog::debug("Cycle budget set to: {}", config.cycleBudget);
+            }
+            catch (const std::exception &e)
+            {
+                spdlog::error("Invalid cycle budget specified: {}", e.what());
+                return 1;
+            }
+        }
+        else if (arg == "--stats-socket")
+        {
+            if (i + 1 < argc)
+            {
+                stats_socket_path = argv[++i];
+                spdlog::debug("Stats socket set to: {}", stats_socket_path);
+            }
+            else
+            {
+                spdlog::error("--stats-socket option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "--stats-file")
+        {
+            if (i + 1 < argc)
+            {
+                stats_file_path = argv[++i];
+                spdlog::debug("Stats file set to: {}", stats_file_path);
+            }
+            else
+            {
+                spdlog::error("--stats-file option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "--batch")
+        {
+            if (i + 1 < argc)
+            {
+                batch_directory = argv[++i];
+                spdlog::debug("Batch directory set to: {}", batch_directory);
+            }
+            else
+            {
+                spdlog::error("--batch option requires an argument.");
+                return 1;
+            }
+        }
+        else if (arg == "-j")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    batch_jobs = std::stoul(argv[++i]);
+                    spdlog::debug("Batch jobs set to: {}", batch_jobs);
+                }
+                catch (const std::exception &e)
+                {
+                    spdlog::error("Invalid job count specified: {}", e.what());
+                    return 1;
+                }
+            }
+            else
+            {
+                spdlog::error("-j option requires an argument.");
+                return 1;
+            }
+        }
         else
         {
             spdlog::error("Unknown argument: \"{}\"", arg);
@@ -175,91 +519,136 @@ int main(int argc, char **argv)
         }
     }
 
-    if (sys_bootstrap.empty())
+    if (config.bootImage.empty() && load_snapshot_path.empty() && batch_directory.empty())
     {
-        spdlog::error("System bootstrap image (--boot-image) is required.");
+        spdlog::error("System bootstrap image (--boot-image) is required unless restoring a snapshot or running a batch.");
         print_help();
         return 1;
     }
 
-    spdlog::debug("Starting sx64 Emulator...");
+    if (save_snapshot_kind == sx64::SnapshotKind::Delta && load_snapshot_path.empty())
+    {
+        spdlog::error("--save-delta needs a snapshot to base the delta on (--load-snapshot).");
+        return 1;
+    }
 
-    auto sys_bootstrap_mem = std::make_shared<MemoryDevice>("sys-bootstrap", 0x1000, true, SX64_ADDR_SYS_BOOTSTRAP);
-    cpu.getBus()->attachDevice(sys_bootstrap_mem);
-    spdlog::debug("System bootstrap memory device attached: 4096 bytes");
+    if (config.coreCount > 1 && (!trace_path.empty() || !profile_path.empty() || !load_snapshot_path.empty() || !save_snapshot_path.empty()))
+    {
+        spdlog::error("Tracing, profiling and snapshots only support a single core (--cores=1).");
+        return 1;
+    }
 
-    std::ifstream sys_image_file(sys_bootstrap, std::ios::binary | std::ios::ate);
-    if (sys_image_file.is_open())
+    // Outlives the machines, so its last stats file has their final counts
+    std::unique_ptr<StatsExporter> stats_exporter;
+    if (!stats_socket_path.empty() || !stats_file_path.empty())
     {
-        std::streamsize size = sys_image_file.tellg();
-        sys_image_file.seekg(0, std::ios::beg);
-        spdlog::trace("System bootstrap image size: {} bytes", size);
-        std::vector<uint8_t> buffer(size);
-        if (sys_image_file.read(reinterpret_cast<char *>(buffer.data()), size))
+        stats_exporter = StatsExporter::create(stats_socket_path, stats_file_path);
+        if (!stats_exporter)
         {
-            spdlog::trace("Loading system bootstrap image from: {}", sys_bootstrap);
-            sys_bootstrap_mem->initializeWithBuffer(buffer.data(), size);
-            spdlog::debug("System bootstrap image loaded successfully");
+            return 1;
         }
-        else
+    }
+
+    if (!batch_directory.empty())
+    {
+        if (!trace_path.empty() || !profile_path.empty() || !load_snapshot_path.empty() || !save_snapshot_path.empty())
         {
-            spdlog::error("Failed to read system bootstrap image");
+            spdlog::error("Tracing, profiling and snapshots are not available in batch mode.");
             return 1;
         }
+
+        // Batch guests run as fast as the host allows and all get a budget, a hung guest must not stall the batch
+        if (!clock_set)
+        {
+            config.clockFrequency = 0;
+        }
+        if (config.cycleBudget == 0)
+        {
+            config.cycleBudget = SX64_BATCH_DEFAULT_BUDGET;
+        }
+        return runBatch(batch_directory, batch_jobs, config);
     }
-    else
+
+    spdlog::debug("Starting sx64 Emulator...");
+
+    std::unique_ptr<SerialBackend> serial_backend = createSerialBackend(serial_spec);
+    if (!serial_backend)
     {
-        spdlog::error("Failed to open system bootstrap image: {}", sys_bootstrap);
         return 1;
     }
 
-    auto ram_mem = std::make_shared<MemoryDevice>("Generic (RAM)", ram_size, false, sys_bootstrap_mem->getBaseAddress() + sys_bootstrap_mem->getSize());
-    cpu.getBus()->attachDevice(ram_mem);
-    spdlog::trace("RAM memory device attached: {} bytes", ram_size);
+    std::unique_ptr<sx64::Machine> machine = sx64::Machine::create(config, std::move(serial_backend));
+    if (!machine)
+    {
+        return 1;
+    }
+    sx64::CPU &cpu = machine->getCpu();
+
+    if (!load_snapshot_path.empty() && !cpu.loadSnapshot(load_snapshot_path))
+    {
+        spdlog::error("Failed to restore snapshot: {}", load_snapshot_path);
+        return 1;
+    }
 
-    if (!krnl_bootstrap.empty())
+    sx64::TraceWriter tracer;
+    if (!trace_path.empty())
     {
-        std::ifstream image_file(krnl_bootstrap, std::ios::binary | std::ios::ate);
-        if (image_file.is_open())
+        if (!tracer.open(trace_path))
         {
-            std::streamsize size = image_file.tellg();
-            image_file.seekg(0, std::ios::beg);
-            spdlog::debug("Kernel bootstrap image size: {} bytes", size);
+            return 1;
+        }
+        cpu.setTracer(&tracer);
+    }
 
-            std::vector<uint8_t> buffer(size);
-            if (image_file.read(reinterpret_cast<char *>(buffer.data()), size))
+    sx64::Profiler profiler(profile_interval);
+    if (!profile_path.empty())
+    {
+        // tools/asm.py writes the symbols of an image next to it, as <image>.map
+        std::vector<std::string> maps;
+        for (const std::string &image : {config.bootImage, config.ramImage})
+        {
+            std::string map = std::filesystem::path(image).replace_extension(".map").string();
+            if (!image.empty() && std::filesystem::exists(map))
             {
-                spdlog::trace("Loading kernel bootstrap image into RAM from: {}", krnl_bootstrap);
-                ram_mem->initializeWithBuffer(buffer.data(), size);
-                spdlog::debug("Kernel bootstrap image loaded into RAM successfully");
+                maps.push_back(map);
             }
-            else
+        }
+        maps.insert(maps.end(), symbol_paths.begin(), symbol_paths.end());
+
+        for (const std::string &path : maps)
+        {
+            if (!profiler.loadSymbols(path))
             {
-                spdlog::error("Failed to read kernel bootstrap image");
                 return 1;
             }
         }
-        else
-        {
-            spdlog::error("Failed to open kernel bootstrap image: {}", krnl_bootstrap);
-            return 1;
-        }
+        cpu.setProfiler(&profiler);
     }
-    else
+
+    machine->run();
+
+    cpu.setTracer(nullptr);
+    tracer.close();
+    cpu.setProfiler(nullptr);
+    if (!profile_path.empty() && !profiler.write(profile_path))
     {
-        spdlog::debug("No kernel bootstrap image provided, initializing RAM with zeros");
-        ram_mem->initialize();
+        return 1;
     }
 
-    auto serial_device = std::make_shared<SerialDevice>("sx64 Serial", 800, 600, ram_mem->getBaseAddress() + ram_mem->getSize());
-    cpu.getBus()->attachDevice(serial_device);
+    if (machine->isBudgetExhausted())
+    {
+        spdlog::warn("Stopped after the budget of {} cycles", config.cycleBudget);
+    }
 
-    spdlog::debug("Running CPU simulation...");
-    cpu.run();
-    spdlog::debug("CPU simulation finished.");
+    if (!save_snapshot_path.empty() && !cpu.saveSnapshot(save_snapshot_path, save_snapshot_kind))
+    {
+        spdlog::error("Failed to save snapshot: {}", save_snapshot_path);
+        return 1;
+    }
 
     spdlog::debug("Dumping CPU state...");
     cpu.dumpState();
+    sx64::Stats::dump();
 
     return 0;
 }
@@ -0,0 +1,142 @@
+#include <stats_export.hpp>
+#include <core/stats.hpp>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+std::unique_ptr<StatsExporter> StatsExporter::create(const std::string &socketPath, const std::string &filePath)
+{
+    int listenFd = -1;
+    if (!socketPath.empty())
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            spdlog::error("Stats socket path \"{}\" is too long", socketPath);
+            return nullptr;
+        }
+        std::strcpy(address.sun_path, socketPath.c_str());
+
+        // A socket left behind by an emulator that did not exit cleanly would make bind fail
+        unlink(socketPath.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd, 8) != 0)
+        {
+            spdlog::error("Could not listen on stats socket \"{}\": {}", socketPath, std::strerror(errno));
+            if (listenFd >= 0)
+            {
+                close(listenFd);
+            }
+            return nullptr;
+        }
+        spdlog::info("Serving stats on {}", socketPath);
+    }
+
+    return std::unique_ptr<StatsExporter>(new StatsExporter(listenFd, socketPath, filePath));
+}
+
+StatsExporter::StatsExporter(int listenFd, const std::string &socketPath, const std::string &filePath)
+    : listenFd(listenFd), socketPath(socketPath), filePath(filePath), fileFailed(false), stopping(false)
+{
+    worker = std::thread(&StatsExporter::serve, this);
+}
+
+StatsExporter::~StatsExporter()
+{
+    stopping = true;
+    worker.join();
+
+    // The last file holds the final counts
+    if (!filePath.empty())
+    {
+        writeFile();
+    }
+
+    if (listenFd >= 0)
+    {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+}
+
+void StatsExporter::serve()
+{
+    using namespace std::chrono;
+
+    steady_clock::time_point nextWrite = steady_clock::now();
+    while (!stopping)
+    {
+        if (!filePath.empty() && steady_clock::now() >= nextWrite)
+        {
+            writeFile();
+            nextWrite += milliseconds(SX64_STATS_FILE_INTERVAL_MS);
+        }
+
+        if (listenFd < 0)
+        {
+            std::this_thread::sleep_for(milliseconds(SX64_STATS_POLL_MS));
+            continue;
+        }
+
+        pollfd listener{listenFd, POLLIN, 0};
+        if (poll(&listener, 1, SX64_STATS_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        int client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client >= 0)
+        {
+            answer(client);
+            close(client);
+        }
+    }
+}
+
+void StatsExporter::answer(int client)
+{
+    timeval timeout{SX64_STATS_SEND_TIMEOUT_MS / 1000, (SX64_STATS_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string text = sx64::Stats::formatPrometheus(sx64::Stats::collect());
+    for (size_t sent = 0; sent < text.size();)
+    {
+        ssize_t result = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            SPDLOG_DEBUG("Stats client went away: {}", std::strerror(errno));
+            return;
+        }
+        sent += result;
+    }
+}
+
+void StatsExporter::writeFile()
+{
+    // Written next to the file and renamed over it, so readers never see half of it
+    std::string temporary = filePath + ".tmp";
+    std::string text = sx64::Stats::formatPrometheus(sx64::Stats::collect());
+
+    std::FILE *file = std::fopen(temporary.c_str(), "w");
+    bool ok = file && std::fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = file && std::fclose(file) == 0 && ok;
+    ok = ok && std::rename(temporary.c_str(), filePath.c_str()) == 0;
+
+    if (!ok && !fileFailed)
+    {
+        spdlog::warn("Could not write stats file \"{}\": {}", filePath, std::strerror(errno));
+        fileFailed = true;
+    }
+}
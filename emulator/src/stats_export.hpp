@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#define SX64_STATS_FILE_INTERVAL_MS 1000 // Between rewrites of the stats file
+#define SX64_STATS_POLL_MS 100           // Longest the exporter waits before checking for shutdown
+#define SX64_STATS_SEND_TIMEOUT_MS 1000  // Clients that do not read their answer in time are dropped
+
+// Publishes the performance counters while the emulator runs, in the Prometheus text format:
+// to every client that connects to a Unix socket, and by rewriting a file every second.
+// Counters are merged from all cores each time they are published.
+class StatsExporter
+{
+public:
+    // Either path may be empty. nullptr when the socket cannot be set up, the reason is logged.
+    static std::unique_ptr<StatsExporter> create(const std::string &socketPath, const std::string &filePath);
+    ~StatsExporter(); // Writes the file one last time and removes the socket
+
+private:
+    StatsExporter(int listenFd, const std::string &socketPath, const std::string &filePath);
+    void serve();
+    void answer(int client);
+    void writeFile();
+
+    int listenFd; // -1 without a socket
+    std::string socketPath;
+    std::string filePath;
+    bool fileFailed; // Only the first failed rewrite is reported
+    std::atomic<bool> stopping;
+    std::thread worker;
+};
@@ -0,0 +1,334 @@
+#include "test_harness.hpp"
+#include <core/machine.hpp>
+#include <core/stats.hpp>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define SX64_TEST_RAM_SIZE (1024 * 1024)
+#define SX64_TEST_PROGRAM SX64_SYS_BOOTSTRAP_SIZE // Start of RAM
+#define SX64_TEST_CYCLE_BUDGET 10000000           // Stops a program that never halts
+#define SX64_TEST_UNMAPPED 0xF000000000ULL        // Past the end of RAM, no device answers there
+#define SX64_TEST_RANDOM_PROGRAMS 100             // Seeds tried by testRandomPrograms
+
+using Program = std::vector<uint8_t>;
+
+// What a run leaves behind that every engine must agree on
+struct EngineRun
+{
+    std::array<uint64_t, 8> registers{};
+    uint16_t flags = 0;
+    uint64_t cycles = 0;
+    std::array<uint64_t, 256> retired{}; // Added by the run, from Stats::collect
+    uint64_t instructions = 0;           // Added by the run, over all cores
+    std::vector<uint16_t> eventFlags;    // FR as each periodic event found it
+};
+
+static const sx64::Engine engines[] = {sx64::Engine::Switch, sx64::Engine::Threaded, sx64::Engine::Jit};
+
+static const char *engineName(sx64::Engine engine)
+{
+    switch (engine)
+    {
+    case sx64::Engine::Switch:
+        return "switch";
+    case sx64::Engine::Threaded:
+        return "threaded";
+    default:
+        return "jit";
+    }
+}
+
+static void emit64(Program &program, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        program.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+static void emitOperand(Program &program, uint8_t opcode, uint8_t reg, uint64_t operand)
+{
+    program.insert(program.end(), {opcode, reg});
+    emit64(program, operand);
+}
+
+static void emitJump(Program &program, uint8_t opcode, uint64_t target)
+{
+    program.push_back(opcode);
+    emit64(program, target);
+}
+
+static uint64_t totalInstructions(const sx64::StatsSnapshot &snapshot)
+{
+    uint64_t total = 0;
+    for (const auto &core : snapshot.cores)
+    {
+        total += core.second.instructions;
+    }
+    return total;
+}
+
+// An eventPeriod other than 0 fires an event that often, stopping runs wherever it falls
+static EngineRun runProgram(sx64::Engine engine, const Program &program, uint64_t eventPeriod)
+{
+    sx64::MachineConfig config;
+    config.ramSize = SX64_TEST_RAM_SIZE;
+    config.engine = engine;
+    config.clockFrequency = 0;
+    config.cycleBudget = SX64_TEST_CYCLE_BUDGET;
+
+    sx64::StatsSnapshot before = sx64::Stats::collect();
+
+    std::unique_ptr<sx64::Machine> machine = sx64::Machine::create(config, std::make_unique<BufferSerialBackend>());
+    machine->getBus()->writeBlock(SX64_TEST_PROGRAM, program.data(), program.size());
+    sx64::CPU &cpu = machine->getCpu();
+    cpu.start(SX64_TEST_PROGRAM, SX64_TEST_PROGRAM + SX64_TEST_RAM_SIZE);
+
+    EngineRun run;
+    std::function<void(uint64_t)> sample = [&](uint64_t now)
+    {
+        run.eventFlags.push_back(cpu.getFlags());
+        cpu.getScheduler().schedule(now + eventPeriod, sample);
+    };
+    if (eventPeriod)
+    {
+        cpu.getScheduler().schedule(eventPeriod, sample);
+    }
+    machine->run();
+
+    sx64::StatsSnapshot after = sx64::Stats::collect();
+
+    for (size_t i = 0; i < run.registers.size(); ++i)
+    {
+        run.registers[i] = cpu.getRegister(i);
+    }
+    run.flags = cpu.getFlags();
+    run.cycles = cpu.getCycles();
+    for (size_t opcode = 0; opcode < run.retired.size(); ++opcode)
+    {
+        run.retired[opcode] = after.retired[opcode] - before.retired[opcode];
+    }
+    run.instructions = totalInstructions(after) - totalInstructions(before);
+    return run;
+}
+
+// Runs program on every engine and checks them against the switch engine
+static void expectSameOnEngines(TestHarness &harness, const std::string &name, const Program &program, uint64_t eventPeriod = 0)
+{
+    EngineRun reference = runProgram(engines[0], program, eventPeriod);
+    for (size_t i = 1; i < std::size(engines); ++i)
+    {
+        EngineRun run = runProgram(engines[i], program, eventPeriod);
+        std::string context = name + " on " + engineName(engines[i]);
+
+        for (size_t reg = 0; reg < run.registers.size(); ++reg)
+        {
+            harness.expectEqual(context + ", R" + std::to_string(reg), run.registers[reg], reference.registers[reg]);
+        }
+        harness.expectEqual(context + ", FR", run.flags, reference.flags);
+        harness.expectEqual(context + ", cycles", run.cycles, reference.cycles);
+        for (size_t opcode = 0; opcode < run.retired.size(); ++opcode)
+        {
+            harness.expectEqual(context + ", retired opcode " + std::to_string(opcode), run.retired[opcode], reference.retired[opcode]);
+        }
+        harness.expectEqual(context + ", instructions", run.instructions, reference.instructions);
+        harness.expectEqual(context + ", events", run.eventFlags.size(), reference.eventFlags.size());
+        for (size_t event = 0; event < std::min(run.eventFlags.size(), reference.eventFlags.size()); ++event)
+        {
+            harness.expectEqual(context + ", FR at event " + std::to_string(event), run.eventFlags[event], reference.eventFlags[event]);
+        }
+    }
+}
+
+// Programs that stop in the middle of a block, leaving the rest of it unexecuted
+static void testHaltMidBlock(TestHarness &harness)
+{
+    using namespace sx64;
+
+    // A loop whose second pass divides by zero, between ALU operations and a CMP/JNE pair
+    {
+        Program program;
+        emitOperand(program, InstructionType::LDI, 1, 5);
+        emitOperand(program, InstructionType::LDI, 2, 1);
+        emitOperand(program, InstructionType::LDI, 3, 3);
+        emitOperand(program, InstructionType::LDI, 4, 0);
+        uint64_t loop = SX64_TEST_PROGRAM + program.size();
+        program.insert(program.end(), {InstructionType::ADD, 1, 3, InstructionType::SUB, 1, 3, InstructionType::MUL, 1, 3,
+                                       InstructionType::DIV, 1, 2, InstructionType::SUB, 2, 2, InstructionType::ADD, 1, 3,
+                                       InstructionType::CMP, 1, 4});
+        emitJump(program, InstructionType::JNE, loop);
+        program.push_back(InstructionType::HLT);
+        expectSameOnEngines(harness, "division by zero", program);
+    }
+
+    // Loads from and reads of unmapped memory halt the core
+    {
+        Program program;
+        emitOperand(program, InstructionType::LDI, 1, 5);
+        emitOperand(program, InstructionType::LDI, 2, SX64_TEST_UNMAPPED);
+        program.insert(program.end(), {InstructionType::ADD, 1, 1, InstructionType::LD64, 3, 2});
+        emit64(program, 0);
+        program.insert(program.end(), {InstructionType::ADD, 1, 1, InstructionType::MUL, 1, 1, InstructionType::HLT});
+        expectSameOnEngines(harness, "unmapped load", program);
+    }
+    {
+        Program program;
+        emitOperand(program, InstructionType::LDI, 1, 5);
+        program.insert(program.end(), {InstructionType::ADD, 1, 1});
+        emitOperand(program, InstructionType::READ, 3, SX64_TEST_UNMAPPED);
+        program.insert(program.end(), {InstructionType::SUB, 1, 1, InstructionType::NOP, InstructionType::HLT});
+        expectSameOnEngines(harness, "unmapped read", program);
+    }
+
+    // A jump to unmapped memory, which the fetch reports
+    {
+        Program program;
+        emitOperand(program, InstructionType::LDI, 1, 5);
+        program.insert(program.end(), {InstructionType::ADD, 1, 1});
+        emitJump(program, InstructionType::JMP, SX64_TEST_UNMAPPED);
+        expectSameOnEngines(harness, "fetch from unmapped memory", program);
+    }
+
+    // A write into the block it runs from, turning the second ADD after it into a HLT
+    {
+        Program program;
+        emitOperand(program, InstructionType::LDI, 1, InstructionType::HLT);
+        program.insert(program.end(), {InstructionType::ADD, 2, 1});
+        uint64_t write = SX64_TEST_PROGRAM + program.size();
+        emitOperand(program, InstructionType::WRITE, 1, write + 10 + 3);
+        program.insert(program.end(), {InstructionType::ADD, 2, 1, InstructionType::ADD, 2, 1, InstructionType::MUL, 2, 1,
+                                       InstructionType::HLT});
+        expectSameOnEngines(harness, "write to own block", program);
+    }
+}
+
+// Events between ALU operations that set the flags one after another, which see the flags of the
+// last operation before them
+static void testEventFlags(TestHarness &harness)
+{
+    using namespace sx64;
+
+    Program program;
+    emitOperand(program, InstructionType::LDI, 1, 1ULL << 63);
+    emitOperand(program, InstructionType::LDI, 2, 3);
+    emitOperand(program, InstructionType::LDI, 3, 0);
+    emitOperand(program, InstructionType::LDI, 4, 40);
+    emitOperand(program, InstructionType::LDI, 5, 1);
+    emitOperand(program, InstructionType::LDI, 6, 0);
+    uint64_t loop = SX64_TEST_PROGRAM + program.size();
+    program.insert(program.end(), {InstructionType::ADD, 1, 1, InstructionType::SUB, 3, 2, InstructionType::MUL, 2, 1,
+                                   InstructionType::CMP, 1, 3, InstructionType::ADD, 2, 5, InstructionType::CMP, 3, 3,
+                                   InstructionType::SUB, 4, 5, InstructionType::CMP, 4, 6});
+    emitJump(program, InstructionType::JNE, loop);
+    program.push_back(InstructionType::HLT);
+
+    for (uint64_t period : {1, 2, 3, 5, 7})
+    {
+        expectSameOnEngines(harness, "flags seen by events every " + std::to_string(period) + " cycles", program, period);
+    }
+}
+
+// A loop of random ALU operations, loads, stores, compares and short forward branches. Some
+// stores land on the code's page, some programs push before halting.
+static Program randomProgram(uint64_t seed)
+{
+    using namespace sx64;
+
+    std::mt19937_64 random(seed);
+    auto below = [&](uint64_t bound) { return random() % bound; };
+    const uint64_t values[] = {0, 1, 2, 3, 7, 255, 1ULL << 63, ~0ULL, random()};
+    const uint64_t data[] = {0x8000, 0x8001, 0x9000, 0x9123};
+    const uint8_t operations[] = {InstructionType::ADD, InstructionType::SUB, InstructionType::MUL, InstructionType::ADD,
+                                  InstructionType::SUB, InstructionType::MUL, InstructionType::DIV};
+
+    Program program;
+    for (uint8_t reg = 0; reg < 8; ++reg)
+    {
+        emitOperand(program, InstructionType::LDI, reg, values[below(std::size(values))]);
+    }
+
+    // R7 counts the iterations down by R6
+    emitOperand(program, InstructionType::LDI, 7, 1 + below(20));
+    emitOperand(program, InstructionType::LDI, 6, 1);
+    uint64_t loop = SX64_TEST_PROGRAM + program.size();
+
+    for (uint64_t i = 0, count = 3 + below(23); i < count; ++i)
+    {
+        uint8_t a = static_cast<uint8_t>(below(6));
+        uint8_t b = static_cast<uint8_t>(below(6));
+        uint64_t kind = below(20);
+        uint64_t address = SX64_TEST_PROGRAM + program.size();
+
+        if (kind < 7)
+        {
+            program.insert(program.end(), {operations[below(std::size(operations))], a, b});
+        }
+        else if (kind < 9)
+        {
+            uint64_t shift = below(64);
+            emitOperand(program, InstructionType::LDI, a, random() >> shift);
+        }
+        else if (kind < 12)
+        {
+            emitOperand(program, InstructionType::WRITE, a, data[below(std::size(data))]);
+        }
+        else if (kind < 14)
+        {
+            emitOperand(program, InstructionType::READ, a, data[below(std::size(data))]);
+        }
+        else if (kind < 16)
+        {
+            program.insert(program.end(), {InstructionType::CMP, a, b});
+        }
+        else if (kind < 17)
+        {
+            program.push_back(InstructionType::NOP);
+        }
+        else if (kind < 18)
+        {
+            // Past the code but on its page, which takes the stores' code-page checks. Random bytes
+            // written into the code itself could name registers that do not exist.
+            emitOperand(program, InstructionType::WRITE, a, SX64_TEST_PROGRAM + 0x700 + below(16));
+        }
+        else
+        {
+            // Skips none or all of the three NOPs after it
+            program.insert(program.end(), {InstructionType::CMP, a, b});
+            uint64_t skip = address + 3 + instructionLength(InstructionType::JE) + 3 * below(2);
+            emitJump(program, below(2) ? InstructionType::JE : InstructionType::JNE, skip);
+            program.insert(program.end(), {InstructionType::NOP, InstructionType::NOP, InstructionType::NOP});
+        }
+    }
+
+    program.insert(program.end(), {InstructionType::SUB, 7, 6});
+    emitOperand(program, InstructionType::LDI, 5, 0);
+    program.insert(program.end(), {InstructionType::CMP, 7, 5});
+    emitJump(program, InstructionType::JNE, loop);
+    if (below(10) == 0)
+    {
+        program.insert(program.end(), {InstructionType::PUSH, 1});
+    }
+    program.push_back(InstructionType::HLT);
+    return program;
+}
+
+static void testRandomPrograms(TestHarness &harness)
+{
+    for (uint64_t seed = 0; seed < SX64_TEST_RANDOM_PROGRAMS; ++seed)
+    {
+        expectSameOnEngines(harness, "random program " + std::to_string(seed), randomProgram(seed));
+    }
+}
+
+void testEngines(TestHarness &harness)
+{
+    testHaltMidBlock(harness);
+    testEventFlags(harness);
+    testRandomPrograms(harness);
+}
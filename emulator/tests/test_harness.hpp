@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+class TestHarness
+{
+public:
+    template <typename T>
+    void expectEqual(const std::string &what, const T &actual, const T &expected)
+    {
+        ++checks;
+        if (!(actual == expected))
+        {
+            ++failures;
+            std::cerr << "FAIL " << what << ": got " << actual << ", expected " << expected << "\n";
+        }
+    }
+
+    uint64_t getChecks() const { return checks; }
+    uint64_t getFailures() const { return failures; }
+
+private:
+    uint64_t checks = 0;
+    uint64_t failures = 0;
+};
+
+// Suites, one per source file
+void testEngines(TestHarness &harness);
@@ -0,0 +1,15 @@
+#include "test_harness.hpp"
+#include <spdlog/spdlog.h>
+#include <iostream>
+
+int main()
+{
+    // Halts, faults and their register dumps are expected here, failures are reported on stderr
+    spdlog::set_level(spdlog::level::off);
+
+    TestHarness harness;
+    testEngines(harness);
+
+    std::cout << harness.getChecks() - harness.getFailures() << "/" << harness.getChecks() << " checks passed\n";
+    return harness.getFailures() ? 1 : 0;
+}
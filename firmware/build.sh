@@ -1,3 +1,3 @@
 #!/bin/bash
 python3 ../tools/asm.py bios.asm ../bios.bin
-python3 ../tools/asm.py boot.asm ../boot.bin
\ No newline at end of file
+python3 ../tools/asm.py --origin 0x1000 boot.asm ../boot.bin
\ No newline at end of file
@@ -1,6 +1,8 @@
 import sys
+import os
 import struct
 import re
+import argparse
 
 # Opcode definitions
 OPCODES = {
@@ -18,7 +20,15 @@ OPCODES = {
     "JMP": 0x0B,
     "CMP": 0x0C,
     "JE": 0x0D,
-    "JNE": 0x0E
+    "JNE": 0x0E,
+    "LD8": 0x0F,
+    "LD16": 0x10,
+    "LD32": 0x11,
+    "LD64": 0x12,
+    "ST8": 0x13,
+    "ST16": 0x14,
+    "ST32": 0x15,
+    "ST64": 0x16
 }
 
 # Register to index mapping
@@ -74,7 +84,11 @@ class Lexer:
                 tokens.append(Token('COLON', ':'))
                 self.advance()
                 continue
-            if self.current_char.isalpha():
+            if self.current_char in '[]+-':
+                tokens.append(Token(self.current_char, self.current_char))
+                self.advance()
+                continue
+            if self.current_char.isalpha() or self.current_char in '_.':
                 tokens.append(self.parse_keyword())
                 continue
             if self.current_char in '0xX0oO0bB' or self.current_char.isdigit():
@@ -88,12 +102,13 @@ class Lexer:
 
     def parse_keyword(self):
         value = ''
-        while self.current_char is not None and (self.current_char.isalpha() or self.current_char.isdigit()):
+        while self.current_char is not None and (self.current_char.isalnum() or self.current_char in '_.'):
             value += self.current_char
             self.advance()
         if re.match(r'^[Rr][0-7]$', value):
             return Token('REGISTER', value.upper())
-        return Token('KEYWORD', value.upper())
+        # Case is kept for labels, instructions are matched case-insensitively
+        return Token('KEYWORD', value)
 
     def parse_number(self):
         value = ''
@@ -145,10 +160,13 @@ class Lexer:
         return Token('CHAR', ord(value))
 
 class Assembler:
-    def __init__(self, tokens):
+    def __init__(self, tokens, origin=0):
         self.tokens = tokens
         self.index = 0
-        self.address = 0
+        self.origin = origin  # Address the output is loaded at, labels are absolute
+        self.labels = {}
+        self.scope = None     # Last global label, '.name' labels are local to it
+        self.fixups = []      # (offset, label) of operands that name a label
 
     def current_token(self):
         if self.index < len(self.tokens):
@@ -168,8 +186,12 @@ class Assembler:
         output_bytes = bytearray()
         while self.index < len(self.tokens):
             token = self.current_token()
-            if token.type == 'KEYWORD':
-                op = self.eat('KEYWORD').value
+            if token.type == 'KEYWORD' and self.peek_type() == 'COLON':
+                self.define_label(self.eat('KEYWORD').value, self.origin + len(output_bytes))
+                self.eat('COLON')
+
+            elif token.type == 'KEYWORD':
+                op = self.eat('KEYWORD').value.upper()
                 if op not in OPCODES:
                     raise ValueError(f"Unknown instruction '{op}'")
                 output_bytes.append(OPCODES[op])  # Write opcode
@@ -185,21 +207,58 @@ class Assembler:
                 elif op in ["NOP", "HLT"]:
                     pass  # No additional operands
 
-                elif op in ["ADD", "SUB", "MUL", "DIV"]:
+                elif op in ["ADD", "SUB", "MUL", "DIV", "CMP"]:
                     self.handle_register_operand(output_bytes)
                     self.handle_register_operand(output_bytes)
 
                 elif op == "PUSH" or op == "POP":
                     self.handle_register_operand(output_bytes)
 
-                elif op in ["CMP", "JE", "JNE", "JMP"]:
+                elif op in ["JE", "JNE", "JMP"]:
                     self.handle_address_operand(output_bytes)
 
+                elif op in ["LD8", "LD16", "LD32", "LD64", "ST8", "ST16", "ST32", "ST64"]:
+                    self.handle_register_operand(output_bytes)
+                    self.handle_memory_operand(output_bytes)
+
             elif token.type == 'NEWLINE':
                 self.eat('NEWLINE')  # Skip newline characters
 
+            else:
+                raise ValueError(f"Unexpected {token.type} with value {token.value}")
+
+        # Labels can be used before they are defined, so operands naming them are filled in last
+        for offset, label in self.fixups:
+            if label not in self.labels:
+                raise ValueError(f"Undefined label '{label}'")
+            output_bytes[offset:offset + 8] = struct.pack('<Q', self.labels[label])
+
         return output_bytes
 
+    def peek_type(self):
+        if self.index + 1 < len(self.tokens):
+            return self.tokens[self.index + 1].type
+        return None
+
+    def qualify(self, label):
+        if label.startswith('.'):
+            if self.scope is None:
+                raise ValueError(f"Local label '{label}' before any global label")
+            return self.scope + label
+        return label
+
+    def define_label(self, label, address):
+        if not label.startswith('.'):
+            self.scope = label
+        label = self.qualify(label)
+        if label in self.labels:
+            raise ValueError(f"Label '{label}' defined twice")
+        self.labels[label] = address
+
+    def symbols(self):
+        # Local labels are left out, each global label starts a function as far as profilers go
+        return sorted((address, label) for label, address in self.labels.items() if '.' not in label)
+
     def handle_register_operand(self, output_bytes):
         if self.current_token().type != 'REGISTER':
             raise ValueError(f"Expected register but got {self.current_token().type} with value {self.current_token().value}")
@@ -213,14 +272,39 @@ class Assembler:
 
     def handle_address_operand(self, output_bytes):
         address_token = self.current_token()
+        if address_token.type == 'KEYWORD':
+            self.eat('KEYWORD')
+            self.fixups.append((len(output_bytes), self.qualify(address_token.value)))
+            self.write_address(output_bytes, 0)
+            return
         if address_token.type not in ['NUMBER', 'CHAR']:
             raise ValueError(f"Expected number or char but got {address_token.type} with value {address_token.value}")
         self.eat(address_token.type)
         address = address_token.value
         self.write_address(output_bytes, address)
 
+    def handle_memory_operand(self, output_bytes):
+        # [Rb], [Rb + displacement] or [Rb - displacement], the displacement may be a label
+        self.eat('[')
+        self.handle_register_operand(output_bytes)
+        sign = self.current_token()
+        if sign.type in ['+', '-']:
+            self.eat(sign.type)
+            if sign.type == '-' and self.current_token().type == 'KEYWORD':
+                raise ValueError(f"Label '{self.current_token().value}' cannot be subtracted")
+            self.handle_address_operand(output_bytes)
+            if sign.type == '-':
+                displacement = struct.unpack('<Q', output_bytes[-8:])[0]
+                output_bytes[-8:] = struct.pack('<Q', -displacement & 0xFFFFFFFFFFFFFFFF)
+        else:
+            self.write_address(output_bytes, 0)
+        self.eat(']')
+
     def handle_immediate_operand(self, output_bytes):
         imm_token = self.current_token()
+        if imm_token.type == 'KEYWORD':
+            self.handle_address_operand(output_bytes)
+            return
         if imm_token.type not in ['NUMBER', 'CHAR']:
             raise ValueError(f"Expected number or char but got {imm_token.type} with value {imm_token.value}")
         self.eat(imm_token.type)
@@ -230,27 +314,38 @@ class Assembler:
     def write_address(self, output_bytes, address):
         output_bytes.extend(struct.pack('<Q', address))
 
-if __name__ == "__main__":
-    if len(sys.argv) != 3:
-        print("Usage: python3 assembler.py <source_file> <output_file>")
-        sys.exit(1)
+def write_symbol_map(path, symbols):
+    # One "address name" line per global label, read by the emulator's profiler
+    with open(path, 'w') as f:
+        for address, label in symbols:
+            f.write(f"{address:016x} {label}\n")
 
-    source_file = sys.argv[1]
-    output_file = sys.argv[2]
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Assemble sx64 source into a raw binary image.")
+    parser.add_argument("source_file")
+    parser.add_argument("output_file")
+    parser.add_argument("--origin", type=lambda value: int(value, 0), default=0,
+                        help="address the image is loaded at, e.g. 0x1000 for RAM images (default: 0)")
+    args = parser.parse_args()
 
     try:
-        with open(source_file, 'r') as f:
+        with open(args.source_file, 'r') as f:
             source_code = f.read()
 
         lexer = Lexer(source_code)
         tokens = lexer.tokenize()
 
-        assembler = Assembler(tokens)
+        assembler = Assembler(tokens, args.origin)
         program_bytes = assembler.parse()
 
-        with open(output_file, 'wb') as f:
+        with open(args.output_file, 'wb') as f:
             f.write(program_bytes)
 
+        # The symbol map sits next to the binary, as <output>.map
+        symbols = assembler.symbols()
+        if symbols:
+            write_symbol_map(os.path.splitext(args.output_file)[0] + '.map', symbols)
+
         # Print the raw bytes to stdout
         sys.stdout.buffer.write(program_bytes)
         
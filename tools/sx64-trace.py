@@ -0,0 +1,125 @@
+import sys
+import struct
+
+# Binary trace decoder for traces written by the emulator's --trace option
+
+TRACE_MAGIC = b"SX64TRC\0"
+HEADER = struct.Struct("<8sII")
+RECORD = struct.Struct("<QQQQBBBBB3x")
+RECORD_V1 = struct.Struct("<QQQBBBBB3x")  # Version 1 kept one byte of each access
+
+ACCESS_NONE = 0
+ACCESS_READ = 1
+ACCESS_WRITE = 2
+
+# Opcode -> (mnemonic, operand format)
+OPCODES = {
+    0x00: ("NOP", ""),
+    0x01: ("HLT", ""),
+    0x02: ("WRITE", "reg_addr"),
+    0x03: ("READ", "reg_addr"),
+    0x04: ("LDI", "reg_imm"),
+    0x05: ("ADD", "reg_reg"),
+    0x06: ("SUB", "reg_reg"),
+    0x07: ("MUL", "reg_reg"),
+    0x08: ("DIV", "reg_reg"),
+    0x09: ("PUSH", "reg"),
+    0x0A: ("POP", "reg"),
+    0x0B: ("JMP", "addr"),
+    0x0C: ("CMP", "reg_reg"),
+    0x0D: ("JE", "addr"),
+    0x0E: ("JNE", "addr"),
+    0x0F: ("LD8", "reg_mem"),
+    0x10: ("LD16", "reg_mem"),
+    0x11: ("LD32", "reg_mem"),
+    0x12: ("LD64", "reg_mem"),
+    0x13: ("ST8", "reg_mem"),
+    0x14: ("ST16", "reg_mem"),
+    0x15: ("ST32", "reg_mem"),
+    0x16: ("ST64", "reg_mem")
+}
+
+def format_operands(kind, reg1, reg2, operand):
+    if kind == "reg_addr":
+        return f"R{reg1}, {operand:#018x}"
+    if kind == "reg_imm":
+        return f"R{reg1}, {operand:#x}"
+    if kind == "reg_reg":
+        return f"R{reg1}, R{reg2}"
+    if kind == "reg_mem":
+        if operand >= 1 << 63:
+            return f"R{reg1}, [R{reg2} - {(1 << 64) - operand:#x}]"
+        return f"R{reg1}, [R{reg2} + {operand:#x}]"
+    if kind == "reg":
+        return f"R{reg1}"
+    if kind == "addr":
+        return f"{operand:#018x}"
+    return ""
+
+def format_record(record):
+    address, operand, bus_address, data, opcode, reg1, reg2, access, size = record
+
+    mnemonic, kind = OPCODES.get(opcode, (f"??? ({opcode:#04x})", ""))
+    line = f"{address:016x}  {mnemonic:<6}{format_operands(kind, reg1, reg2, operand)}"
+
+    width = 2 + 2 * size
+    if access == ACCESS_READ:
+        line += f"    ; read  [{bus_address:#018x}] -> {data:#0{width}x}"
+    elif access == ACCESS_WRITE:
+        line += f"    ; write [{bus_address:#018x}] <- {data:#0{width}x}"
+
+    return line
+
+def decode(trace_file, out):
+    header = trace_file.read(HEADER.size)
+    if len(header) < HEADER.size:
+        raise ValueError("File is too short to be a trace")
+
+    magic, version, record_size = HEADER.unpack(header)
+    if magic != TRACE_MAGIC:
+        raise ValueError("Not an sx64 trace file")
+    if (version, record_size) == (2, RECORD.size):
+        layout = RECORD
+    elif (version, record_size) == (1, RECORD_V1.size):
+        layout = RECORD_V1
+    else:
+        raise ValueError(f"Unsupported trace version {version} (record size {record_size})")
+
+    count = 0
+    while True:
+        chunk = trace_file.read(layout.size * 4096)
+        if not chunk:
+            break
+
+        whole = len(chunk) - len(chunk) % layout.size
+        for record in layout.iter_unpack(chunk[:whole]):
+            if layout is RECORD_V1:
+                address, operand, bus_address, opcode, reg1, reg2, access, data = record
+                record = (address, operand, bus_address, data, opcode, reg1, reg2, access, 1)
+            out.write(format_record(record) + "\n")
+            count += 1
+
+        if whole != len(chunk):
+            print("Warning: trace ends with a partial record", file=sys.stderr)
+            break
+
+    return count
+
+if __name__ == "__main__":
+    if len(sys.argv) not in (2, 3):
+        print("Usage: python3 sx64-trace.py <trace_file> [output_file]")
+        sys.exit(1)
+
+    try:
+        with open(sys.argv[1], 'rb') as trace_file:
+            if len(sys.argv) == 3:
+                with open(sys.argv[2], 'w') as out:
+                    count = decode(trace_file, out)
+            else:
+                count = decode(trace_file, sys.stdout)
+
+        print(f"{count} instructions", file=sys.stderr)
+
+    except Exception as e:
+        print(f"Error: {e}")
+        sys.exit(1)